@@ -0,0 +1,639 @@
+/*
+  --- ALLOCATOR BENCHMARKS ---
+
+  Measures the allocators of the library against `malloc()`/`free()` under
+  a few workloads:
+    fixed   - allocate and free 64-byte blocks.
+    mixed   - the same with sizes between 16 bytes and 1 KiB, mostly small.
+    grow    - allocate only; the allocator is reset between batches.
+    churn   - keep 1024 blocks of mixed sizes alive and replace a random one
+              per operation, which fragments the free lists.
+    push    - append integers to a dynamic array, restarting at 4096.
+    mt      - churn on 4 threads, sharing the allocator if it's thread-safe
+              and using one per thread otherwise.
+  Operations are timed in batches of `BENCH_BATCH`, since a clock read costs
+  more than most allocations. The percentiles are over the per-operation
+  means of the batches, so they show slow batches, not single slow operations.
+  Every benchmark prints one JSON object per line:
+    {"bench": ..., "workload": ..., "threads": ..., "ops": ...,
+     "ns_per_op": mean, "p50_batch_mean_ns": median batch mean,
+     "p99_batch_mean_ns": 99th percentile batch mean}
+
+  Usage: base_bench [batches per thread] [filter]
+  Only benchmarks whose name or workload contains the filter are run.
+
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "base/allocators.h"
+#include "base/gpa.h"
+
+#define BENCH_BATCH 64
+#define BENCH_SIZES 4096
+#define BENCH_LIVE 1024
+#define BENCH_FIXED_SIZE 64
+#define BENCH_DARRAY_LEN 4096
+#define BENCH_THREADS 4
+#define BENCH_BUF_SIZE ((size_t)16 * 1024 * 1024)
+
+typedef struct bench_ctx bench_ctx_t;
+typedef void (*bench_fn)(bench_ctx_t* ctx);
+
+typedef struct bench_case {
+  const char* name;
+  const char* workload;
+  bench_fn fn;
+  size_t size;                // Fixed block size, or 0 for mixed sizes.
+  size_t threads;
+} bench_case_t;
+
+struct bench_ctx {
+  bench_fn fn;
+  size_t size;
+  size_t batches;
+  size_t seed;
+  double* samples;            // Nanoseconds per operation of each batch.
+  unsigned char* buf;         // Backing memory for allocators on a fixed buffer.
+  cpool_t* shared_pool;
+};
+
+static size_t bench_sizes[BENCH_SIZES];
+static uint32_t bench_picks[BENCH_SIZES];
+static void* volatile bench_sink;
+
+// Integer nanoseconds, since a double can't resolve them at the magnitude of the epoch.
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t* state)
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *state = x;
+}
+
+static void bench_init_tables(void)
+{
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+
+  // Powers of 2 from 16 to 1024 plus some jitter, with small sizes most common.
+  for (size_t i = 0; i < BENCH_SIZES; ++i) {
+    uint64_t r = xorshift(&state);
+    unsigned shift = (unsigned)(r % 28);
+    shift = shift < 12 ? 0 : shift < 19 ? 1 : shift < 23 ? 2 : shift < 25 ? 3 : shift - 21;
+    bench_sizes[i] = ((size_t)16 << shift) + (size_t)((r >> 32) % 16);
+    bench_picks[i] = (uint32_t)((r >> 16) % BENCH_LIVE);
+  }
+}
+
+static inline size_t bench_size(bench_ctx_t* ctx, size_t n)
+{
+  return ctx->size ? ctx->size : bench_sizes[(ctx->seed + n) & (BENCH_SIZES - 1)];
+}
+
+static inline uint32_t bench_pick(bench_ctx_t* ctx, size_t n)
+{
+  return bench_picks[(ctx->seed * 7 + n) & (BENCH_SIZES - 1)];
+}
+
+static inline void bench_record(bench_ctx_t* ctx, size_t batch, uint64_t start)
+{
+  ctx->samples[batch] = (double)(now_ns() - start) / BENCH_BATCH;
+}
+
+/*
+  --- ALLOCATE AND FREE ---
+*/
+
+static void bench_malloc_free(bench_ctx_t* ctx)
+{
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      void* ptr = malloc(bench_size(ctx, b * BENCH_BATCH + i));
+      bench_sink = ptr;
+      free(ptr);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_pool_free(bench_ctx_t* ctx)
+{
+  pool_t pool;
+  pool_init(&pool, ctx->buf, BENCH_BUF_SIZE, BENCH_FIXED_SIZE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      void* ptr = pool_alloc_nozero(&pool);
+      bench_sink = ptr;
+      pool_free(&pool, ptr);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_stack_pop(bench_ctx_t* ctx)
+{
+  stack_t stack;
+  stack_init(&stack, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      bench_sink = stack_alloc_nozero(&stack, bench_size(ctx, b * BENCH_BATCH + i));
+      stack_pop(&stack);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_free_list_free(bench_ctx_t* ctx, fl_policy policy)
+{
+  free_list_t fl;
+  free_list_init(&fl, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      void* ptr = free_list_alloc_nozero(&fl, bench_size(ctx, b * BENCH_BATCH + i), policy);
+      bench_sink = ptr;
+      free_list_free(&fl, ptr);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_free_list_first_free(bench_ctx_t* ctx)
+{
+  bench_free_list_free(ctx, FIRST_SLOT);
+}
+
+static void bench_free_list_best_free(bench_ctx_t* ctx)
+{
+  bench_free_list_free(ctx, BEST_SLOT);
+}
+
+static void bench_tlsf_free(bench_ctx_t* ctx)
+{
+  tlsf_t tlsf;
+  tlsf_init(&tlsf, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      void* ptr = tlsf_alloc_nozero(&tlsf, bench_size(ctx, b * BENCH_BATCH + i));
+      bench_sink = ptr;
+      tlsf_free(&tlsf, ptr);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_gpa_free(bench_ctx_t* ctx)
+{
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      void* ptr = gpa_alloc(bench_size(ctx, b * BENCH_BATCH + i));
+      bench_sink = ptr;
+      gpa_free(ptr);
+    }
+
+    bench_record(ctx, b, start);
+  }
+
+  gpa_thread_flush();
+}
+
+/*
+  --- ALLOCATE ONLY ---
+*/
+
+static void bench_malloc_grow(bench_ctx_t* ctx)
+{
+  void* ptrs[BENCH_BATCH];
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i)
+      ptrs[i] = malloc(bench_size(ctx, b * BENCH_BATCH + i));
+
+    bench_record(ctx, b, start);
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i)
+      free(ptrs[i]);
+  }
+}
+
+static void bench_arena_grow(bench_ctx_t* ctx)
+{
+  arena_t arena;
+  arena_init(&arena, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i)
+      bench_sink = arena_alloc_nozero(&arena, bench_size(ctx, b * BENCH_BATCH + i));
+
+    bench_record(ctx, b, start);
+    arena_clear(&arena);
+  }
+}
+
+/*
+  --- CHURN ---
+
+  Each operation frees a random one of the live blocks and allocates a new
+  one in its place. The initial fill and the final cleanup are not timed.
+*/
+
+static void bench_malloc_churn(bench_ctx_t* ctx)
+{
+  void* live[BENCH_LIVE];
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    live[i] = malloc(bench_size(ctx, i));
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      size_t n = b * BENCH_BATCH + i;
+      uint32_t k = bench_pick(ctx, n);
+      free(live[k]);
+      live[k] = malloc(bench_size(ctx, n));
+    }
+
+    bench_record(ctx, b, start);
+  }
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    free(live[i]);
+}
+
+static void bench_pool_churn(bench_ctx_t* ctx)
+{
+  void* live[BENCH_LIVE];
+  pool_t pool;
+  pool_init(&pool, ctx->buf, BENCH_BUF_SIZE, BENCH_FIXED_SIZE);
+  pool_alloc_n_nozero(&pool, live, BENCH_LIVE);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      uint32_t k = bench_pick(ctx, b * BENCH_BATCH + i);
+      pool_free(&pool, live[k]);
+      live[k] = pool_alloc_nozero(&pool);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_cpool_churn(bench_ctx_t* ctx)
+{
+  void* live[BENCH_LIVE];
+  cpool_t* pool = ctx->shared_pool;
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    live[i] = cpool_alloc_nozero(pool);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      uint32_t k = bench_pick(ctx, b * BENCH_BATCH + i);
+      cpool_free(pool, live[k]);
+      live[k] = cpool_alloc_nozero(pool);
+    }
+
+    bench_record(ctx, b, start);
+  }
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    cpool_free(pool, live[i]);
+
+  cpool_thread_flush();
+}
+
+static void bench_free_list_churn(bench_ctx_t* ctx, fl_policy policy)
+{
+  void* live[BENCH_LIVE];
+  free_list_t fl;
+  free_list_init(&fl, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    live[i] = free_list_alloc_nozero(&fl, bench_size(ctx, i), policy);
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      size_t n = b * BENCH_BATCH + i;
+      uint32_t k = bench_pick(ctx, n);
+      free_list_free(&fl, live[k]);
+      live[k] = free_list_alloc_nozero(&fl, bench_size(ctx, n), policy);
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_free_list_first_churn(bench_ctx_t* ctx)
+{
+  bench_free_list_churn(ctx, FIRST_SLOT);
+}
+
+static void bench_free_list_best_churn(bench_ctx_t* ctx)
+{
+  bench_free_list_churn(ctx, BEST_SLOT);
+}
+
+static void bench_tlsf_churn(bench_ctx_t* ctx)
+{
+  void* live[BENCH_LIVE];
+  tlsf_t tlsf;
+  tlsf_init(&tlsf, ctx->buf, BENCH_BUF_SIZE);
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    live[i] = tlsf_alloc_nozero(&tlsf, bench_size(ctx, i));
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      size_t n = b * BENCH_BATCH + i;
+      uint32_t k = bench_pick(ctx, n);
+      tlsf_free(&tlsf, live[k]);
+      live[k] = tlsf_alloc_nozero(&tlsf, bench_size(ctx, n));
+    }
+
+    bench_record(ctx, b, start);
+  }
+}
+
+static void bench_gpa_churn(bench_ctx_t* ctx)
+{
+  void* live[BENCH_LIVE];
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    live[i] = gpa_alloc(bench_size(ctx, i));
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < BENCH_BATCH; ++i) {
+      size_t n = b * BENCH_BATCH + i;
+      uint32_t k = bench_pick(ctx, n);
+      gpa_free(live[k]);
+      live[k] = gpa_alloc(bench_size(ctx, n));
+    }
+
+    bench_record(ctx, b, start);
+  }
+
+  for (size_t i = 0; i < BENCH_LIVE; ++i)
+    gpa_free(live[i]);
+
+  gpa_thread_flush();
+}
+
+/*
+  --- DYNAMIC ARRAYS ---
+*/
+
+static void bench_realloc_push(bench_ctx_t* ctx)
+{
+  int* data = NULL;
+  size_t len = 0;
+  size_t cap = 0;
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < BENCH_BATCH; ++i) {
+      if (len == cap) {
+        cap = cap ? cap * 2 : 8;
+        data = (int*)realloc(data, cap * sizeof(int));
+      }
+
+      data[len++] = i;
+    }
+
+    bench_record(ctx, b, start);
+
+    if (len >= BENCH_DARRAY_LEN) {
+      bench_sink = data;
+      free(data);
+      data = NULL;
+      len = cap = 0;
+    }
+  }
+
+  free(data);
+}
+
+static void bench_darray_push_with(bench_ctx_t* ctx, arena_t* arena)
+{
+  int* darray = NULL;
+
+  for (size_t b = 0; b < ctx->batches; ++b) {
+    if (!darray)
+      darray = arena ? darray_init_alloc(sizeof(int), 8, arena_allocator(arena)) : darray_init(sizeof(int), 8);
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < BENCH_BATCH; ++i)
+      darray_push(darray, i);
+
+    bench_record(ctx, b, start);
+
+    if (darray_size(darray) >= BENCH_DARRAY_LEN) {
+      bench_sink = darray;
+      darray_free(darray);
+      darray = NULL;
+
+      if (arena)
+        arena_clear(arena);
+    }
+  }
+
+  darray_free(darray);
+}
+
+static void bench_darray_push(bench_ctx_t* ctx)
+{
+  bench_darray_push_with(ctx, NULL);
+}
+
+static void bench_darray_push_arena(bench_ctx_t* ctx)
+{
+  arena_t arena;
+  arena_init(&arena, ctx->buf, BENCH_BUF_SIZE);
+  bench_darray_push_with(ctx, &arena);
+}
+
+/*
+  --- HARNESS ---
+*/
+
+static const bench_case_t bench_cases[] = {
+  { "malloc/free",                "fixed", bench_malloc_free,           BENCH_FIXED_SIZE, 1 },
+  { "pool_alloc/pool_free",       "fixed", bench_pool_free,             BENCH_FIXED_SIZE, 1 },
+  { "stack_alloc/stack_pop",      "fixed", bench_stack_pop,             BENCH_FIXED_SIZE, 1 },
+  { "free_list_alloc/free first", "fixed", bench_free_list_first_free,  BENCH_FIXED_SIZE, 1 },
+  { "free_list_alloc/free best",  "fixed", bench_free_list_best_free,   BENCH_FIXED_SIZE, 1 },
+  { "tlsf_alloc/tlsf_free",       "fixed", bench_tlsf_free,             BENCH_FIXED_SIZE, 1 },
+  { "gpa_alloc/gpa_free",         "fixed", bench_gpa_free,              BENCH_FIXED_SIZE, 1 },
+
+  { "malloc/free",                "mixed", bench_malloc_free,           0, 1 },
+  { "stack_alloc/stack_pop",      "mixed", bench_stack_pop,             0, 1 },
+  { "free_list_alloc/free first", "mixed", bench_free_list_first_free,  0, 1 },
+  { "free_list_alloc/free best",  "mixed", bench_free_list_best_free,   0, 1 },
+  { "tlsf_alloc/tlsf_free",       "mixed", bench_tlsf_free,             0, 1 },
+  { "gpa_alloc/gpa_free",         "mixed", bench_gpa_free,              0, 1 },
+
+  { "malloc",                     "grow",  bench_malloc_grow,           0, 1 },
+  { "arena_alloc",                "grow",  bench_arena_grow,            0, 1 },
+
+  { "malloc/free",                "churn", bench_malloc_churn,          0, 1 },
+  { "pool_alloc/pool_free",       "churn", bench_pool_churn,            BENCH_FIXED_SIZE, 1 },
+  { "free_list_alloc/free first", "churn", bench_free_list_first_churn, 0, 1 },
+  { "free_list_alloc/free best",  "churn", bench_free_list_best_churn,  0, 1 },
+  { "tlsf_alloc/tlsf_free",       "churn", bench_tlsf_churn,            0, 1 },
+  { "gpa_alloc/gpa_free",         "churn", bench_gpa_churn,             0, 1 },
+
+  { "realloc",                    "push",  bench_realloc_push,          0, 1 },
+  { "darray_push",                "push",  bench_darray_push,           0, 1 },
+  { "darray_push arena",          "push",  bench_darray_push_arena,     0, 1 },
+
+  { "malloc/free",                "mt",    bench_malloc_churn,          0, BENCH_THREADS },
+  { "gpa_alloc/gpa_free",         "mt",    bench_gpa_churn,             0, BENCH_THREADS },
+  { "cpool_alloc/cpool_free",     "mt",    bench_cpool_churn,           BENCH_FIXED_SIZE, BENCH_THREADS },
+  { "pool_alloc/pool_free",       "mt",    bench_pool_churn,            BENCH_FIXED_SIZE, BENCH_THREADS },
+  { "tlsf_alloc/tlsf_free",       "mt",    bench_tlsf_churn,            0, BENCH_THREADS },
+};
+
+static int bench_thread(void* arg)
+{
+  bench_ctx_t* ctx = (bench_ctx_t*)arg;
+  ctx->fn(ctx);
+  return 0;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static void run(const bench_case_t* c, size_t batches)
+{
+  bench_ctx_t ctx[BENCH_THREADS];
+  thrd_t threads[BENCH_THREADS];
+  size_t count = batches * c->threads;
+  double* samples = (double*)malloc(count * sizeof(double));
+
+  // Room for every live slot of all threads, plus their magazines.
+  static unsigned char cpool_buf[(BENCH_THREADS * BENCH_LIVE + BENCH_THREADS * CPOOL_MAGAZINE_SIZE) * BENCH_FIXED_SIZE];
+  cpool_t shared_pool;
+  cpool_init(&shared_pool, cpool_buf, sizeof(cpool_buf), BENCH_FIXED_SIZE);
+
+  if (!samples) {
+    fprintf(stderr, "bench: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t t = 0; t < c->threads; ++t) {
+    ctx[t] = (bench_ctx_t){ c->fn, c->size, batches, t * 1237, samples + t * batches, NULL, &shared_pool };
+    ctx[t].buf = (unsigned char*)malloc(BENCH_BUF_SIZE);
+
+    if (!ctx[t].buf) {
+      fprintf(stderr, "bench: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+
+    // Fault the pages in up front, so the first batches don't pay for it.
+    memset(ctx[t].buf, 0, BENCH_BUF_SIZE);
+  }
+
+  if (c->threads == 1) {
+    c->fn(&ctx[0]);
+  } else {
+    for (size_t t = 0; t < c->threads; ++t)
+      thrd_create(&threads[t], bench_thread, &ctx[t]);
+
+    for (size_t t = 0; t < c->threads; ++t)
+      thrd_join(threads[t], NULL);
+  }
+
+  double sum = 0.0;
+
+  for (size_t i = 0; i < count; ++i)
+    sum += samples[i];
+
+  qsort(samples, count, sizeof(double), compare_doubles);
+
+  printf("{\"bench\": \"%s\", \"workload\": \"%s\", \"threads\": %zu, \"ops\": %zu, "
+    "\"ns_per_op\": %.2f, \"p50_batch_mean_ns\": %.2f, \"p99_batch_mean_ns\": %.2f}\n",
+    c->name, c->workload, c->threads, count * BENCH_BATCH,
+    sum / (double)count, samples[count / 2], samples[count - 1 - count / 100]);
+  fflush(stdout);
+
+  for (size_t t = 0; t < c->threads; ++t)
+    free(ctx[t].buf);
+
+  free(samples);
+}
+
+int main(int argc, char** argv)
+{
+  size_t batches = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 4096;
+  const char* filter = argc > 2 ? argv[2] : NULL;
+
+  if (batches == 0) {
+    fprintf(stderr, "Usage: %s [batches per thread] [filter]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bench_init_tables();
+
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); ++i) {
+    const bench_case_t* c = &bench_cases[i];
+
+    if (!filter || strstr(c->name, filter) || strstr(c->workload, filter))
+      run(c, batches);
+  }
+
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+  --- QUEUE BENCHMARK ---
+
+  Measures the throughput of the bounded queues: one producer and one
+  consumer thread pass pool slots back and forth, first one at a time and
+  then in batches. The MPMC queue additionally runs with several producers
+  and consumers. Before that, a queue of capacity 1 is checked to keep two
+  items in order.
+
+  Usage: queue_bench [items per producer]
+
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#include "base/allocators.h"
+#include "base/queue.h"
+
+#define BENCH_CAPACITY 1024
+#define BENCH_BATCH 32
+#define BENCH_MAX_THREADS 4
+
+typedef struct bench_ctx {
+  spsc_t* spsc;
+  mpmc_t* mpmc;
+  size_t items;
+  size_t batch;
+  void* slot;
+} bench_ctx_t;
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int spsc_producer(void* arg)
+{
+  bench_ctx_t* ctx = (bench_ctx_t*)arg;
+  void* items[BENCH_BATCH];
+
+  for (size_t i = 0; i < BENCH_BATCH; ++i)
+    items[i] = ctx->slot;
+
+  for (size_t sent = 0; sent < ctx->items;) {
+    size_t left = ctx->items - sent;
+    size_t n = ctx->batch < left ? ctx->batch : left;
+
+    if (n == 1) {
+      if (spsc_push(ctx->spsc, ctx->slot))
+        ++sent;
+      else
+        thrd_yield();
+    } else {
+      size_t pushed = spsc_push_n(ctx->spsc, items, n);
+      sent += pushed;
+
+      if (pushed == 0)
+        thrd_yield();
+    }
+  }
+
+  return 0;
+}
+
+static int spsc_consumer(void* arg)
+{
+  bench_ctx_t* ctx = (bench_ctx_t*)arg;
+  void* items[BENCH_BATCH];
+
+  for (size_t received = 0; received < ctx->items;) {
+    size_t popped = ctx->batch == 1 ?
+      (size_t)spsc_pop(ctx->spsc, items) :
+      spsc_pop_n(ctx->spsc, items, ctx->batch);
+    received += popped;
+
+    if (popped == 0)
+      thrd_yield();
+  }
+
+  return 0;
+}
+
+static int mpmc_producer(void* arg)
+{
+  bench_ctx_t* ctx = (bench_ctx_t*)arg;
+  void* items[BENCH_BATCH];
+
+  for (size_t i = 0; i < BENCH_BATCH; ++i)
+    items[i] = ctx->slot;
+
+  for (size_t sent = 0; sent < ctx->items;) {
+    size_t left = ctx->items - sent;
+    size_t n = ctx->batch < left ? ctx->batch : left;
+    size_t pushed = n == 1 ? (size_t)mpmc_push(ctx->mpmc, ctx->slot) : mpmc_push_n(ctx->mpmc, items, n);
+    sent += pushed;
+
+    if (pushed == 0)
+      thrd_yield();
+  }
+
+  return 0;
+}
+
+static int mpmc_consumer(void* arg)
+{
+  bench_ctx_t* ctx = (bench_ctx_t*)arg;
+  void* items[BENCH_BATCH];
+
+  for (size_t received = 0; received < ctx->items;) {
+    size_t left = ctx->items - received;
+    size_t n = ctx->batch < left ? ctx->batch : left;
+    size_t popped = n == 1 ? (size_t)mpmc_pop(ctx->mpmc, items) : mpmc_pop_n(ctx->mpmc, items, n);
+    received += popped;
+
+    if (popped == 0)
+      thrd_yield();
+  }
+
+  return 0;
+}
+
+/// Pushes two items into queues created with capacity 1 and pops them again.
+static bool check_small(void)
+{
+  int a, b;
+  void* items[2] = { NULL, NULL };
+  bool ok = true;
+
+  spsc_t spsc;
+  spsc_init(&spsc, 1, heap_allocator());
+  ok &= spsc_push(&spsc, &a) && spsc_pop(&spsc, &items[0]) && items[0] == &a && !spsc_pop(&spsc, &items[0]);
+  spsc_release(&spsc);
+
+  mpmc_t mpmc;
+  mpmc_init(&mpmc, 1, heap_allocator());
+  ok &= mpmc_push(&mpmc, &a) && mpmc_push(&mpmc, &b);
+  ok &= mpmc_pop(&mpmc, &items[0]) && mpmc_pop(&mpmc, &items[1]) && !mpmc_pop(&mpmc, &items[0]);
+  ok &= items[0] == &a && items[1] == &b;
+  mpmc_release(&mpmc);
+
+  if (!ok)
+    fprintf(stderr, "queue of capacity 1: items lost or reordered\n");
+
+  return ok;
+}
+
+static void run(const char* name, thrd_start_t producer, thrd_start_t consumer, bench_ctx_t* ctx, size_t threads)
+{
+  thrd_t producers[BENCH_MAX_THREADS];
+  thrd_t consumers[BENCH_MAX_THREADS];
+  double start = now_ns();
+
+  for (size_t i = 0; i < threads; ++i) {
+    thrd_create(&producers[i], producer, ctx);
+    thrd_create(&consumers[i], consumer, ctx);
+  }
+
+  for (size_t i = 0; i < threads; ++i) {
+    thrd_join(producers[i], NULL);
+    thrd_join(consumers[i], NULL);
+  }
+
+  double elapsed = now_ns() - start;
+  double total = (double)(ctx->items * threads);
+
+  printf("%-24s %8.2f ns/item %8.2f Mitems/s\n", name, elapsed / total, total / elapsed * 1e3);
+}
+
+int main(int argc, char** argv)
+{
+  size_t items = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 10000000;
+
+  if (!check_small())
+    return EXIT_FAILURE;
+
+  static unsigned char pool_buf[4096];
+  pool_t pool;
+  pool_init(&pool, pool_buf, sizeof(pool_buf), 64);
+
+  spsc_t spsc;
+  mpmc_t mpmc;
+  spsc_init(&spsc, BENCH_CAPACITY, heap_allocator());
+  mpmc_init(&mpmc, BENCH_CAPACITY, heap_allocator());
+
+  bench_ctx_t ctx = { &spsc, &mpmc, items, 1, pool_alloc(&pool) };
+
+  run("spsc", spsc_producer, spsc_consumer, &ctx, 1);
+  run("mpmc 1x1", mpmc_producer, mpmc_consumer, &ctx, 1);
+  run("mpmc 4x4", mpmc_producer, mpmc_consumer, &ctx, 4);
+
+  ctx.batch = BENCH_BATCH;
+  run("spsc batch", spsc_producer, spsc_consumer, &ctx, 1);
+  run("mpmc 1x1 batch", mpmc_producer, mpmc_consumer, &ctx, 1);
+  run("mpmc 4x4 batch", mpmc_producer, mpmc_consumer, &ctx, 4);
+
+  spsc_release(&spsc);
+  mpmc_release(&mpmc);
+
+  return 0;
+}
@@ -1,6 +1,6 @@
 @echo off
 
-set COMP_FLAGS=/W4 /WX
+set COMP_FLAGS=/W4 /WX /std:c11 /experimental:c11atomics
 
 set SRC_DIR=src\base
 set BUILD_DIR=base
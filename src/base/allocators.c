@@ -1,13 +1,115 @@
 #include "base/allocators.h"
 #include "base/log.h"
 #include "base/mem_utils.h"
+#include "base/vmem.h"
+
+static void* heap_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  if (align > DEFAULT_ALIGN) {
+    flog(LOG_ERROR, "heap_allocator: alignment larger than DEFAULT_ALIGN not supported");
+    return NULL;
+  }
+
+  return malloc(size);
+}
+
+static void* heap_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  if (align > DEFAULT_ALIGN) {
+    flog(LOG_ERROR, "heap_allocator: alignment larger than DEFAULT_ALIGN not supported");
+    return NULL;
+  }
+
+  return realloc(ptr, new_size);
+}
+
+static void heap_free(void* ctx, void* ptr, size_t size)
+{
+  free(ptr);
+}
+
+allocator_t heap_allocator(void)
+{
+  allocator_t a = { heap_alloc, heap_resize, heap_free, NULL };
+  return a;
+}
+
+void alloc_stats_log(const char* name, const alloc_stats_t* stats)
+{
+  VALIDATE_PTR(stats);
+
+  flog(LOG_INFO, "%s: %zu of %zu bytes in use, peak %zu, %zu allocs, %zu frees, %zu failed",
+    name, stats->in_use, stats->capacity, stats->peak, stats->allocs, stats->frees, stats->failed);
+
+  if (stats->free_blocks > 0)
+    flog(LOG_INFO, "%s: %zu free bytes in %zu blocks, largest %zu, fragmentation %.1f%%",
+      name, stats->free_bytes, stats->free_blocks, stats->largest_free, stats->fragmentation * 100.0);
+}
+
+/// Adds a free block of `size` bytes to the statistics.
+static void alloc_stats_free_block(alloc_stats_t* stats, size_t size)
+{
+  stats->free_bytes += size;
+  ++stats->free_blocks;
+
+  if (size > stats->largest_free)
+    stats->largest_free = size;
+
+  stats->fragmentation = 1.0 - (double)stats->largest_free / (double)stats->free_bytes;
+}
+
+#ifdef BASE_DEBUG
+
+typedef struct leak_report {
+  const char* func;
+  size_t count;
+  size_t bytes;
+} leak_report_t;
+
+/// Adds a block that is still in use to the report, listing the first `LEAK_REPORT_MAX`.
+static void leak_report_add(leak_report_t* report, void* ptr, size_t size)
+{
+  if (report->count < LEAK_REPORT_MAX)
+    flog(LOG_INFO, "%s(): block %p of %zu bytes still in use", report->func, ptr, size);
+
+  ++report->count;
+  report->bytes += size;
+}
+
+static void leak_report_end(leak_report_t* report)
+{
+  if (report->count > 0)
+    flog(LOG_WARNING, "%s(): %zu blocks (%zu bytes) were still in use", report->func, report->count, report->bytes);
+}
+
+#endif
+
+/// Resizes by allocating a new block and copying, for allocators without a better way.
+static void* allocator_move(void* (*alloc)(void*, size_t, uintptr_t), void (*free_fn)(void*, void*, size_t),
+  void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  void* new_ptr = alloc(ctx, new_size, align);
+
+  if (!new_ptr || !ptr)
+    return new_ptr;
+
+  memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  free_fn(ctx, ptr, old_size);
+
+  return new_ptr;
+}
 
 void* darray_init(size_t element_size, size_t num)
+{
+  return darray_init_alloc(element_size, num, heap_allocator());
+}
+
+void* darray_init_alloc(size_t element_size, size_t num, allocator_t allocator)
 {
   uintptr_t hdr_size = align_size(sizeof(da_hdr_t), DEFAULT_ALIGN);
   
   size_t raw_size = hdr_size + element_size * num;
-  void* raw = malloc(raw_size);
+  void* raw = allocator_alloc(&allocator, raw_size, DEFAULT_ALIGN);
 
   if (!raw) {
     flog(LOG_ERROR, "darray_init(): buffer allocation failed");
@@ -18,6 +120,7 @@ void* darray_init(size_t element_size, size_t num)
   hdr->capacity = num;
   hdr->occupied = 0;
   hdr->element_size = element_size;
+  hdr->allocator = allocator;
 
   void* buf = (void*)((uintptr_t)hdr + hdr_size);
 
@@ -36,9 +139,11 @@ void* darray_alloc(void* darray, size_t element_size, size_t num)
   if (needed_size > hdr->capacity) {
     size_t double_cap = hdr->capacity * 2;
     size_t new_cap = (needed_size > double_cap) ? needed_size : double_cap;
+    size_t old_size = (size_t)hdr_size + hdr->capacity * element_size;
     size_t new_size = (size_t)hdr_size + new_cap * element_size;
+    allocator_t allocator = hdr->allocator;
 
-    void* new_raw = realloc(hdr, new_size);
+    void* new_raw = allocator_resize(&allocator, hdr, old_size, new_size, DEFAULT_ALIGN);
     
     if (!new_raw) {
         flog(LOG_ERROR, "darray_alloc(): re-allocation failed");
@@ -56,43 +161,85 @@ void* darray_alloc(void* darray, size_t element_size, size_t num)
 
 void* darray_make_space(void* darray, size_t pos, size_t element_size, size_t num)
 {
+  size_t old_size = darray ? darray_get_hdr(darray)->occupied : 0;
+
+  if (pos > old_size) {
+    flog(LOG_ERROR, "darray_make_space(): position out of bounds");
+    exit(EXIT_FAILURE);
+  }
+
   darray = darray_alloc(darray, element_size, num);
 
   // darray_alloc() guarantees a valid darray (or crash).
 
-  uintptr_t ptr = (uintptr_t)darray;
-  da_hdr_t* hdr = darray_get_hdr(darray);
+  unsigned char* old_pos = (unsigned char*)darray + pos * element_size;
+  size_t mem_right = (old_size - pos) * element_size;
+
+  memmove(old_pos + num * element_size, old_pos, mem_right);
+
+  return darray;
+}
+
+void* darray_push_n_base(void* darray, const void* elements, size_t element_size, size_t num)
+{
+  size_t old_size = darray ? darray_get_hdr(darray)->occupied : 0;
 
-  uintptr_t mem_occ = (uintptr_t)(hdr->occupied * element_size);
-  uintptr_t mem_left = (uintptr_t)(pos * element_size);
-  uintptr_t mem_right = mem_occ - mem_left;
-  uintptr_t old_pos = ptr + mem_left;
-  uintptr_t offset = (uintptr_t)(element_size * num);
-  uintptr_t new_pos = old_pos + offset;
+  darray = darray_alloc(darray, element_size, num);
+  memcpy((unsigned char*)darray + old_size * element_size, elements, num * element_size);
+
+  return darray;
+}
 
-  memcpy((void*)new_pos, (void*)old_pos, mem_right);
+void* darray_insert_n_base(void* darray, size_t pos, const void* elements, size_t element_size, size_t num)
+{
+  darray = darray_make_space(darray, pos, element_size, num);
+  memcpy((unsigned char*)darray + pos * element_size, elements, num * element_size);
 
   return darray;
 }
 
-void darray_pop_last(void* darray)
+void darray_erase_range(void* darray, size_t first, size_t num)
 {
   VALIDATE_PTR(darray);
 
   da_hdr_t* hdr = darray_get_hdr(darray);
-  hdr->occupied -= 1;
+
+  if (first > hdr->occupied || num > hdr->occupied - first) {
+    flog(LOG_WARNING, "darray_erase_range: range out of bounds");
+    return;
+  }
+
+  unsigned char* dst = (unsigned char*)darray + first * hdr->element_size;
+  size_t mem_right = (hdr->occupied - first - num) * hdr->element_size;
+
+  memmove(dst, dst + num * hdr->element_size, mem_right);
+  hdr->occupied -= num;
 }
 
-void darray_pop_first(void* darray)
+void darray_free(void* darray)
+{
+  CHECK_PTR(darray);
+
+  da_hdr_t* hdr = darray_get_hdr(darray);
+  uintptr_t hdr_size = align_size(sizeof(da_hdr_t), DEFAULT_ALIGN);
+  allocator_t allocator = hdr->allocator;
+
+  allocator_free(&allocator, hdr, (size_t)hdr_size + hdr->capacity * hdr->element_size);
+}
+
+void darray_pop_last(void* darray)
 {
   VALIDATE_PTR(darray);
 
   da_hdr_t* hdr = darray_get_hdr(darray);
-  uintptr_t second_element_ptr = (uintptr_t)darray + (uintptr_t)hdr->element_size;
   hdr->occupied -= 1;
-  size_t size = hdr->occupied * hdr->element_size;
+}
+
+void darray_pop_first(void* darray)
+{
+  VALIDATE_PTR(darray);
 
-  memcpy(darray, (void*)second_element_ptr, size);
+  darray_erase_range(darray, 0, 1);
 }
 
 void darray_clear(void* darray)
@@ -142,11 +289,13 @@ void darray_reserve_base(void** darray, size_t new_cap)
   if (new_cap < hdr->capacity) return;
 
   uintptr_t hdr_size = align_size(sizeof(da_hdr_t), DEFAULT_ALIGN);
+  size_t old_size = (size_t)hdr_size + hdr->capacity * hdr->element_size;
   size_t new_size = (size_t)hdr_size + new_cap * hdr->element_size;
+  allocator_t allocator = hdr->allocator;
 
-  void* new_raw = realloc(hdr, new_size);
+  void* new_raw = allocator_resize(&allocator, hdr, old_size, new_size, DEFAULT_ALIGN);
     
-  VALIDATE_PTR(new_raw);
+  CHECK_PTR(new_raw);
 
   hdr = (da_hdr_t*)new_raw;
   hdr->capacity = new_cap; 
@@ -162,8 +311,10 @@ void darray_shrink_to_fit_base(void** darray)
   uintptr_t hdr_size = align_size(sizeof(da_hdr_t), DEFAULT_ALIGN);
 
   size_t new_cap = hdr->occupied;
+  size_t old_size = (size_t)hdr_size + hdr->element_size * hdr->capacity;
   size_t new_size = (size_t)hdr_size + hdr->element_size * new_cap; 
-  void* new_raw = realloc(hdr, new_size);
+  allocator_t allocator = hdr->allocator;
+  void* new_raw = allocator_resize(&allocator, hdr, old_size, new_size, DEFAULT_ALIGN);
   
   if (!new_raw) {
     flog(LOG_ERROR, "darray_shrink_to_fit: re-allocation failed");
@@ -176,249 +327,1646 @@ void darray_shrink_to_fit_base(void** darray)
   *darray = (void*)((uintptr_t)hdr + hdr_size);
 }
 
-void arena_init(arena_t* a, void* buf, size_t size)
+void* deque_init(size_t element_size, size_t num)
 {
-  VALIDATE_PTR(buf);
-
-  a->size = size;
-  a->curr_offset = 0;
-  a->prev_offset = 0;
-  a->buf = (unsigned char*)buf;
+  return deque_init_alloc(element_size, num, heap_allocator());
 }
 
-void* arena_alloc_align(arena_t* a, size_t size, uintptr_t align)
+void* deque_init_alloc(size_t element_size, size_t num, allocator_t allocator)
 {
-  VALIDATE_PTR(a, NULL);
+  uintptr_t hdr_size = align_size(sizeof(dq_hdr_t), DEFAULT_ALIGN);
+  size_t capacity = (size_t)next_pow2(num);
 
-  uintptr_t curr_ptr = (uintptr_t)(a->buf + a->curr_offset);
-  uintptr_t offset_ptr = align_ptr(curr_ptr, align);
-  offset_ptr -= (uintptr_t)a->buf;
+  void* raw = allocator_alloc(&allocator, (size_t)hdr_size + capacity * element_size, DEFAULT_ALIGN);
 
-  if ((size_t)offset_ptr + size > a->size) {
-    flog(LOG_ERROR, "Arena allocation out of bounds");
+  if (!raw) {
+    flog(LOG_ERROR, "deque_init(): buffer allocation failed");
     exit(EXIT_FAILURE);
-  } 
+  }
 
-  a->prev_offset = offset_ptr;
-  a->curr_offset = offset_ptr + size;
+  dq_hdr_t* hdr = (dq_hdr_t*)raw;
+  hdr->capacity = capacity;
+  hdr->head = 0;
+  hdr->occupied = 0;
+  hdr->element_size = element_size;
+  hdr->allocator = allocator;
 
-  void* ptr = a->buf + offset_ptr;
+  return (void*)((uintptr_t)hdr + hdr_size);
+}
+
+void deque_free(void* deque)
+{
+  CHECK_PTR(deque);
+
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  uintptr_t hdr_size = align_size(sizeof(dq_hdr_t), DEFAULT_ALIGN);
+  allocator_t allocator = hdr->allocator;
 
-  return memset(ptr, 0, size);
+  allocator_free(&allocator, hdr, (size_t)hdr_size + hdr->capacity * hdr->element_size);
 }
 
-void arena_resize_element_align(arena_t* a, void* element, size_t old_size, size_t new_size, uintptr_t align)
+void* deque_grow(void* deque, size_t element_size, size_t num)
 {
-  VALIDATE_PTR(a);
+  if (!deque)
+    return deque_init(element_size, num);
 
-  if (!element) {
-    element = arena_alloc_align(a, new_size, align);
-    return;
-  }
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  size_t needed = hdr->occupied + num;
 
-  unsigned char* i = (unsigned char*)element;
+  if (needed <= hdr->capacity)
+    return deque;
 
-  if (a->buf > i || i > a->buf + a->size) {
-    flog(LOG_ERROR, "Resized arena element out of bounds");
-    exit(EXIT_FAILURE);
-  } 
+  uintptr_t hdr_size = align_size(sizeof(dq_hdr_t), DEFAULT_ALIGN);
+  size_t old_cap = hdr->capacity;
+  size_t new_cap = old_cap;
 
-  if (i == a->buf + a->prev_offset) {
-    a->curr_offset = a->prev_offset + new_size;
-    
-    if (new_size > old_size)
-      memset(i + old_size, 0, new_size - old_size);
+  while (new_cap < needed)
+    new_cap *= 2;
+
+  allocator_t allocator = hdr->allocator;
+  void* new_raw = allocator_resize(&allocator, hdr, (size_t)hdr_size + old_cap * element_size,
+    (size_t)hdr_size + new_cap * element_size, DEFAULT_ALIGN);
+
+  if (!new_raw) {
+    flog(LOG_ERROR, "deque_grow(): re-allocation failed");
+    exit(EXIT_FAILURE);
   }
 
-  else {
-    void* resized_element = arena_alloc_align(a, new_size, align);
-    size_t size = new_size < old_size ? new_size : old_size;
-    memcpy(resized_element, element, size);
-    element = resized_element;
+  hdr = (dq_hdr_t*)new_raw;
+  hdr->capacity = new_cap;
+  unsigned char* data = (unsigned char*)hdr + hdr_size;
+
+  // Elements that wrapped around the old end move behind it, which
+  // always fits, since the capacity at least doubled.
+  if (hdr->head + hdr->occupied > old_cap) {
+    size_t wrapped = hdr->head + hdr->occupied - old_cap;
+    memcpy(data + old_cap * element_size, data, wrapped * element_size);
   }
+
+  return data;
 }
 
-uintptr_t align_ptr_hdr(uintptr_t ptr, uintptr_t align, size_t hdr_size)
+void deque_pop_front(void* deque)
 {
-  if (!is_pow2(align)) {
-    flog(LOG_ERROR, "Given alignment no power of 2");
-    exit(EXIT_FAILURE);
-  }
+  deque_pop_front_n(deque, 1);
+}
 
-  uintptr_t needed_size = (uintptr_t)hdr_size; 
-  uintptr_t align_mask = align - 1;
-  uintptr_t mod = ptr & align_mask;
-  uintptr_t padding = 0;
+void deque_pop_back(void* deque)
+{
+  VALIDATE_PTR(deque);
 
-  padding = align - mod;
+  dq_hdr_t* hdr = deque_get_hdr(deque);
 
-  if (padding < needed_size) {
-    needed_size -= padding;
+  if (hdr->occupied == 0) {
+    flog(LOG_WARNING, "deque_pop_back(): deque empty");
+    return;
+  }
 
-    if ((needed_size & align_mask) != 0) 
-      padding += align * (1 + needed_size / align);
+  --hdr->occupied;
+}
 
-    else
-      padding += needed_size;
+void deque_pop_front_n(void* deque, size_t num)
+{
+  VALIDATE_PTR(deque);
+
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+
+  if (num > hdr->occupied) {
+    flog(LOG_WARNING, "deque_pop_front_n(): fewer than %zu elements in deque", num);
+    num = hdr->occupied;
   }
-  
-  return ptr + padding;
+
+  hdr->head = (hdr->head + num) & (hdr->capacity - 1);
+  hdr->occupied -= num;
 }
 
-void stack_init(stack_t* s, void* buf, size_t size)
+void deque_clear(void* deque)
 {
-  VALIDATE_PTR(buf);
+  VALIDATE_PTR(deque);
 
-  s->size = size;
-  s->curr_offset = 0;
-  s->curr_hdr = NULL;
-  s->buf = (unsigned char*)buf;
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  hdr->head = 0;
+  hdr->occupied = 0;
 }
 
-void* stack_alloc_align(stack_t* s, size_t size, uintptr_t align)
+size_t deque_spans(void* deque, deque_span_t spans[2])
 {
-  VALIDATE_PTR(s, NULL);
+  spans[0].data = spans[1].data = NULL;
+  spans[0].len = spans[1].len = 0;
 
-  uintptr_t curr_ptr = (uintptr_t)(s->buf + s->curr_offset);
-  uintptr_t offset_ptr = align_ptr_hdr(curr_ptr, align, sizeof(hdr_t));
-  offset_ptr -= (uintptr_t)s->buf;
+  VALIDATE_PTR(deque, 0);
 
-  // ???
-  if ((size_t)offset_ptr + size > s->size) {
-    flog(LOG_ERROR, "Stack allocation out of bounds");
-    exit(EXIT_FAILURE);
-  }
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  unsigned char* data = (unsigned char*)deque;
+  size_t first_len = hdr->capacity - hdr->head;
 
-  s->curr_offset = offset_ptr + size;
-  unsigned char* ptr = s->buf + offset_ptr;
+  if (first_len > hdr->occupied)
+    first_len = hdr->occupied;
 
-  hdr_t* header = (hdr_t*)(ptr - sizeof(hdr_t));
+  spans[0].data = data + hdr->head * hdr->element_size;
+  spans[0].len = first_len;
 
-  if (s->curr_hdr)
-    header->linked_hdr = s->curr_hdr;
-  
-  s->curr_hdr = header;
+  if (first_len == hdr->occupied)
+    return first_len > 0 ? 1 : 0;
 
-  return memset(ptr, 0, size);
+  spans[1].data = data;
+  spans[1].len = hdr->occupied - first_len;
+
+  return 2;
 }
 
-void stack_resize_element_align(stack_t* s, void* element, size_t old_size, size_t new_size, uintptr_t align)
+static inline void arena_stats_init(arena_t* a)
 {
-  if (!element) {
-    element = stack_alloc_align(s, new_size, align);
-    return;
-  }
-  
-  unsigned char* i = (unsigned char*)element;
-  
-  if (!within_bounds(i, s->buf, s->size)) {
-    flog(LOG_ERROR, "Resized stack element out of bounds");
-    exit(EXIT_FAILURE);
-  } 
+#ifdef BASE_STATS
+  STATS_INIT(&a->stats);
+  a->stats_base = 0;
+#endif
+}
 
-  unsigned char* last_element = (unsigned char*)s->curr_hdr + sizeof(hdr_t);
+void arena_init(arena_t* a, void* buf, size_t size)
+{
+  VALIDATE_PTR(buf);
 
-  if (i == last_element) {
-    s->curr_offset = (uintptr_t)s->curr_hdr + sizeof(hdr_t) + new_size;
-    
-    if (new_size > old_size)
-      memset(i + old_size, 0, new_size - old_size);
-  }
+  a->size = size;
+  a->curr_offset = 0;
+  a->prev_offset = 0;
+  a->buf = (unsigned char*)buf;
+  a->committed = size;
+  a->mode = ARENA_FIXED;
+  a->block = NULL;
+  a->block_size = 0;
+  a->high_water = 0;
+  a->temp_depth = 0;
+  arena_stats_init(a);
+  MEM_ASAN_POISON(a->buf, size);
+}
 
-  else {
-    void* resized_element = stack_alloc_align(s, new_size, align);
-    size_t size = new_size < old_size ? new_size : old_size;
-    memcpy(resized_element, element, size);
-    element = resized_element;
-  }
+static inline unsigned char* arena_block_data(arena_block_t* block)
+{
+  return (unsigned char*)block + align_size(sizeof(arena_block_t), DEFAULT_ALIGN);
 }
 
-void pool_init_align(pool_t* p, void* buf, size_t size, size_t slot_size, uintptr_t align)
+static bool arena_push_block(arena_t* a, size_t size)
 {
-  VALIDATE_PTR(buf);
+  size_t hdr_size = (size_t)align_size(sizeof(arena_block_t), DEFAULT_ALIGN);
 
-  uintptr_t buf_zero = (uintptr_t)buf;
-  uintptr_t buf_zero_aligned = align_ptr(buf_zero, align);
-  size -= buf_zero_aligned - buf_zero;
-  slot_size = align_size(slot_size, align);
-  
-  p->size = size;
-  p->slot_size = slot_size;
-  p->curr_hdr = NULL;
-  p->buf = (unsigned char*)buf;
+#ifdef BASE_GUARD_PAGES
+  // The data has to end right at the guard page.
+  size = (size_t)align_size(size, DEFAULT_ALIGN);
+  arena_block_t* block = (arena_block_t*)vmem_alloc_guarded(hdr_size + size);
+#else
+  arena_block_t* block = (arena_block_t*)malloc(hdr_size + size);
+#endif
 
-  pool_free_all(p);
+  if (!block)
+    return false;
+
+  block->prev = a->block;
+  block->size = size;
+
+#ifdef BASE_STATS
+  if (a->block)
+    a->stats_base += a->size;
+#endif
+
+  a->block = block;
+  a->buf = arena_block_data(block);
+  a->size = size;
+  a->committed = size;
+  a->curr_offset = 0;
+  a->prev_offset = 0;
+  MEM_ASAN_POISON(a->buf, size);
+
+  return true;
 }
 
-void* pool_alloc(pool_t* p)
+static void arena_free_block(arena_block_t* block)
 {
-  VALIDATE_PTR(p, NULL);
+  MEM_ASAN_UNPOISON(arena_block_data(block), block->size);
 
-  hdr_t* hdr = p->curr_hdr;
+#ifdef BASE_GUARD_PAGES
+  vmem_free_guarded(block, (size_t)align_size(sizeof(arena_block_t), DEFAULT_ALIGN) + block->size);
+#else
+  free(block);
+#endif
+}
 
-  VALIDATE_PTR(hdr, NULL);
+void arena_init_chained(arena_t* a, size_t block_size)
+{
+  VALIDATE_PTR(a);
 
-  p->curr_hdr = p->curr_hdr->linked_hdr;
-  return memset(hdr, 0, p->slot_size);
+  a->mode = ARENA_CHAINED;
+  a->block = NULL;
+  a->block_size = block_size;
+  a->high_water = 0;
+  a->temp_depth = 0;
+  arena_stats_init(a);
+
+  if (!arena_push_block(a, block_size)) {
+    flog(LOG_ERROR, "arena_init_chained(): block allocation failed");
+    exit(EXIT_FAILURE);
+  }
 }
 
-void pool_free(pool_t* p, void* slot)
+void arena_init_virtual(arena_t* a, size_t reserve_size, size_t high_water)
 {
-  VALIDATE_PTR(p);
-  VALIDATE_PTR(slot);
+  VALIDATE_PTR(a);
 
-  uintptr_t buf_int = (uintptr_t)p->buf;
-  uintptr_t end_int = (uintptr_t)(p->buf + p->size);
-  uintptr_t seg_int = (uintptr_t)slot;
+  size_t page_size = vmem_page_size();
+  reserve_size = (size_t)align_size(reserve_size, page_size);
+  void* buf = vmem_reserve(reserve_size);
 
-  // ???
-  if (seg_int < buf_int || seg_int >= end_int) {
-    flog(LOG_WARNING, "Failed to free pool slot: Given address out of bounds");
-    return;
+  if (!buf) {
+    flog(LOG_ERROR, "arena_init_virtual(): reserving %zu bytes failed", reserve_size);
+    exit(EXIT_FAILURE);
   }
 
-  hdr_t* hdr = (hdr_t*)slot;
-  hdr->linked_hdr = p->curr_hdr;
-  p->curr_hdr = hdr;
-  slot = NULL;
+  a->buf = (unsigned char*)buf;
+  a->size = reserve_size;
+  a->curr_offset = 0;
+  a->prev_offset = 0;
+  a->committed = 0;
+  a->mode = ARENA_VIRTUAL;
+  a->block = NULL;
+  a->block_size = 0;
+  a->high_water = high_water == SIZE_MAX ? SIZE_MAX : (size_t)align_size(high_water, page_size);
+  a->temp_depth = 0;
+  arena_stats_init(a);
 }
 
-void pool_free_all(pool_t* p)
+void arena_release(arena_t* a)
 {
-  VALIDATE_PTR(p);
+  VALIDATE_PTR(a);
+
+  switch (a->mode) {
+    case ARENA_CHAINED:
+      while (a->block) {
+        arena_block_t* prev = a->block->prev;
+        arena_free_block(a->block);
+        a->block = prev;
+      }
+      break;
 
-  size_t slot_count = p->size / p->slot_size;
+    case ARENA_VIRTUAL:
+      MEM_ASAN_UNPOISON(a->buf, a->committed);
+      vmem_release(a->buf, a->size);
+      break;
+
+    case ARENA_FIXED:
+      MEM_ASAN_UNPOISON(a->buf, a->size);
+      break;
 
-  for (size_t i = 0; i < slot_count; ++i) {
-    hdr_t* hdr = (hdr_t*)(p->buf + i * p->slot_size);
-    hdr->linked_hdr = p->curr_hdr;
-    p->curr_hdr = hdr;
+    case ARENA_NUM_MODES:
+    default:
+      break;
   }
+
+  a->buf = NULL;
+  a->size = 0;
+  a->committed = 0;
+  a->curr_offset = 0;
+  a->prev_offset = 0;
+
+#ifdef BASE_STATS
+  a->stats_base = 0;
+#endif
+  STATS_USAGE(&a->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_ARENA, a, NULL, NULL, 0, 0);
 }
 
-void free_list_init_align(free_list_t* fl, void* buf, size_t size, uintptr_t align)
+bool arena_grow(arena_t* a, size_t end, size_t size, uintptr_t align)
 {
-  uintptr_t buf_zero = (uintptr_t)buf;
-  uintptr_t buf_zero_aligned = align_ptr(buf_zero, align);
-  uintptr_t diff = buf_zero_aligned - buf_zero; 
-  
-  fl->buf = (unsigned char*)buf_zero_aligned;
-  fl->size = size - diff;
+  switch (a->mode) {
+    case ARENA_VIRTUAL: {
+      if (end > a->size)
+        return false;
+
+      size_t new_committed = (size_t)align_size(end, ARENA_COMMIT_SIZE);
+
+      if (new_committed > a->size)
+        new_committed = a->size;
+
+      if (!vmem_commit(a->buf + a->committed, new_committed - a->committed))
+        return false;
+
+      MEM_ASAN_POISON(a->buf + a->committed, new_committed - a->committed);
+      a->committed = new_committed;
+      return true;
+    }
+
+    case ARENA_CHAINED: {
+      size_t needed = size + (size_t)align;
+      return arena_push_block(a, needed > a->block_size ? needed : a->block_size);
+    }
+
+    case ARENA_FIXED:
+    case ARENA_NUM_MODES:
+    default:
+      return false;
+  }
+}
+
+void* arena_alloc_align(arena_t* a, size_t size, uintptr_t align)
+{
+  void* ptr = arena_alloc_nozero_align(a, size, align);
+  return ptr ? memset(ptr, 0, size) : NULL;
+}
+
+void* arena_alloc_nozero_align(arena_t* a, size_t size, uintptr_t align)
+{
+  VALIDATE_PTR(a, NULL);
+
+  uintptr_t curr_ptr = (uintptr_t)(a->buf + a->curr_offset);
+  uintptr_t offset_ptr = align_ptr(curr_ptr, align);
+  offset_ptr -= (uintptr_t)a->buf;
+  size_t block_size = size + MEM_TRAILER_SIZE;
+
+  if ((size_t)offset_ptr + block_size > a->committed) {
+    if (!arena_grow(a, (size_t)offset_ptr + block_size, block_size, align)) {
+      flog(LOG_ERROR, "Arena allocation out of bounds");
+      exit(EXIT_FAILURE);
+    }
+
+    curr_ptr = (uintptr_t)(a->buf + a->curr_offset);
+    offset_ptr = align_ptr(curr_ptr, align) - (uintptr_t)a->buf;
+  }
+
+  a->prev_offset = offset_ptr;
+  a->curr_offset = offset_ptr + block_size;
+  STATS_ALLOC(&a->stats, 0);
+  STATS_USAGE(&a->stats, a->stats_base + a->curr_offset);
+
+  void* ptr = a->buf + offset_ptr;
+  TRACE(TRACE_ALLOC, TRACE_ARENA, a, ptr, NULL, size, align);
+  mem_canary_set(ptr, size, block_size);
+
+  return mem_poison(ptr, size);
+}
+
+/// Checks if `ptr` points into memory handed out by the arena.
+static bool arena_owns(arena_t* a, unsigned char* ptr)
+{
+  if (a->mode != ARENA_CHAINED)
+    return a->buf <= ptr && ptr <= a->buf + a->committed;
+
+  for (arena_block_t* block = a->block; block; block = block->prev) {
+    unsigned char* data = arena_block_data(block);
+
+    if (data <= ptr && ptr <= data + block->size)
+      return true;
+  }
+
+  return false;
+}
+
+/// Resizes an arena element, extending or shrinking the last one in place.
+static void* arena_resize_impl(arena_t* a, void* element, size_t old_size, size_t new_size, uintptr_t align, bool zero)
+{
+  if (!element)
+    return zero ? arena_alloc_align(a, new_size, align) : arena_alloc_nozero_align(a, new_size, align);
+
+  unsigned char* i = (unsigned char*)element;
+
+  if (!arena_owns(a, i)) {
+    flog(LOG_ERROR, "Resized arena element out of bounds");
+    exit(EXIT_FAILURE);
+  } 
+
+  bool is_last = i == a->buf + a->prev_offset && a->prev_offset + old_size + MEM_TRAILER_SIZE == a->curr_offset;
+  size_t new_end = a->prev_offset + new_size + MEM_TRAILER_SIZE;
+
+  // A virtual arena can always extend its last element in place, if the reserve allows.
+  if (is_last && new_end > a->committed && a->mode == ARENA_VIRTUAL)
+    arena_grow(a, new_end, new_size, align);
+
+  if (is_last && new_end <= a->committed) {
+#ifdef BASE_DEBUG
+    arena_check_last(a, "arena_resize_element");
+#endif
+    if (new_end < a->curr_offset)
+      MEM_ASAN_POISON(a->buf + new_end, a->curr_offset - new_end);
+
+    a->curr_offset = new_end;
+    STATS_USAGE(&a->stats, a->stats_base + a->curr_offset);
+    TRACE(TRACE_RESIZE, TRACE_ARENA, a, element, element, new_size, align);
+    mem_canary_set(element, new_size, new_size + MEM_TRAILER_SIZE);
+    
+    if (zero && new_size > old_size)
+      memset(i + old_size, 0, new_size - old_size);
+
+    return element;
+  }
+
+  if (new_size <= old_size) {
+    TRACE(TRACE_RESIZE, TRACE_ARENA, a, element, element, new_size, align);
+    return element;
+  }
+
+  // The moved element is traced as a new allocation, since the old one stays in place.
+  void* resized_element = zero ? arena_alloc_align(a, new_size, align) : arena_alloc_nozero_align(a, new_size, align);
+  memcpy(resized_element, element, old_size);
+
+  return resized_element;
+}
+
+void* arena_resize_element_align(arena_t* a, void* element, size_t old_size, size_t new_size, uintptr_t align)
+{
+  VALIDATE_PTR(a, NULL);
+
+  return arena_resize_impl(a, element, old_size, new_size, align, true);
+}
+
+void arena_zero(arena_t* a)
+{
+  VALIDATE_PTR(a);
+
+#ifdef BASE_DEBUG
+  // The canary of the last element is restored afterwards.
+  size_t last_size = 0;
+
+  if (a->curr_offset > a->prev_offset)
+    last_size = mem_canary_check(a->buf + a->prev_offset, a->curr_offset - a->prev_offset, "arena_zero");
+#endif
+
+  if (a->mode != ARENA_CHAINED) {
+    MEM_ASAN_UNPOISON(a->buf, a->committed);
+    memset(a->buf, 0, a->committed);
+  } else {
+    for (arena_block_t* block = a->block; block; block = block->prev) {
+      MEM_ASAN_UNPOISON(arena_block_data(block), block->size);
+      memset(arena_block_data(block), 0, block->size);
+    }
+  }
+
+  MEM_ASAN_POISON(a->buf + a->curr_offset, a->committed - a->curr_offset);
+
+#ifdef BASE_DEBUG
+  if (a->curr_offset > a->prev_offset)
+    mem_canary_set(a->buf + a->prev_offset, last_size, a->curr_offset - a->prev_offset);
+#endif
+}
+
+void arena_check_last(arena_t* a, const char* func)
+{
+  VALIDATE_PTR(a);
+
+  if (a->curr_offset > a->prev_offset)
+    mem_canary_check(a->buf + a->prev_offset, a->curr_offset - a->prev_offset, func);
+}
+
+void arena_temp_end(arena_temp_t temp)
+{
+  arena_t* a = temp.arena;
+
+  VALIDATE_PTR(a);
+
+  if (temp.depth != a->temp_depth)
+    flog(LOG_WARNING, "arena_temp_end(): scope %zu ended while %zu is open", temp.depth, a->temp_depth);
+
+  if (a->mode == ARENA_CHAINED) {
+    while (a->block != temp.block && a->block->prev) {
+      arena_block_t* prev = a->block->prev;
+      arena_free_block(a->block);
+      a->block = prev;
+
+#ifdef BASE_STATS
+      a->stats_base -= prev->size;
+#endif
+    }
+
+    a->buf = arena_block_data(a->block);
+    a->size = a->block->size;
+    a->committed = a->size;
+  }
+
+  a->curr_offset = temp.curr_offset;
+  a->prev_offset = temp.prev_offset;
+  a->temp_depth = temp.depth - 1;
+  MEM_ASAN_POISON(a->buf + a->curr_offset, a->committed - a->curr_offset);
+  STATS_USAGE(&a->stats, a->stats_base + a->curr_offset);
+  TRACE(TRACE_ROLLBACK, TRACE_ARENA, a, a->buf + a->curr_offset, NULL, 0, 0);
+}
+
+void arena_clear(arena_t* a)
+{
+  VALIDATE_PTR(a);
+
+#ifdef BASE_DEBUG
+  arena_check_last(a, "arena_clear");
+#endif
+
+  a->curr_offset = 0;
+  a->prev_offset = 0;
+  a->temp_depth = 0;
+
+#ifdef BASE_STATS
+  a->stats_base = 0;
+#endif
+  STATS_USAGE(&a->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_ARENA, a, NULL, NULL, 0, 0);
+
+  if (a->mode == ARENA_CHAINED) {
+    while (a->block->prev) {
+      arena_block_t* prev = a->block->prev;
+      arena_free_block(a->block);
+      a->block = prev;
+    }
+
+    a->buf = arena_block_data(a->block);
+    a->size = a->block->size;
+    a->committed = a->size;
+  }
+
+  else if (a->mode == ARENA_VIRTUAL && a->committed > a->high_water) {
+    MEM_ASAN_UNPOISON(a->buf + a->high_water, a->committed - a->high_water);
+    vmem_decommit(a->buf + a->high_water, a->committed - a->high_water);
+    a->committed = a->high_water;
+  }
+
+  MEM_ASAN_POISON(a->buf, a->committed);
+}
+
+alloc_stats_t arena_stats(arena_t* a)
+{
+  alloc_stats_t stats = { 0 };
+
+  VALIDATE_PTR(a, stats);
+
+#ifdef BASE_STATS
+  stats = a->stats;
+#endif
+
+  if (a->mode != ARENA_CHAINED) {
+    stats.capacity = a->committed;
+    return stats;
+  }
+
+  for (arena_block_t* block = a->block; block; block = block->prev)
+    stats.capacity += block->size;
+
+  return stats;
+}
+
+static THREAD_LOCAL arena_t scratch_arenas[SCRATCH_COUNT];
+
+arena_temp_t scratch_begin(arena_t** conflicts, size_t num_conflicts)
+{
+  for (size_t i = 0; i < SCRATCH_COUNT; ++i) {
+    arena_t* a = &scratch_arenas[i];
+    bool conflicting = false;
+
+    for (size_t j = 0; j < num_conflicts; ++j) {
+      if (conflicts[j] == a) {
+        conflicting = true;
+        break;
+      }
+    }
+
+    if (conflicting)
+      continue;
+
+    if (!a->buf)
+      arena_init_virtual(a, SCRATCH_RESERVE_SIZE, SCRATCH_HIGH_WATER);
+
+    return arena_temp_begin(a);
+  }
+
+  flog(LOG_ERROR, "scratch_begin(): all %d scratch arenas are in use", SCRATCH_COUNT);
+  exit(EXIT_FAILURE);
+}
+
+void scratch_release(void)
+{
+  for (size_t i = 0; i < SCRATCH_COUNT; ++i) {
+    if (scratch_arenas[i].buf)
+      arena_release(&scratch_arenas[i]);
+  }
+}
+
+uintptr_t align_ptr_hdr(uintptr_t ptr, uintptr_t align, size_t hdr_size)
+{
+  if (!is_pow2(align)) {
+    flog(LOG_ERROR, "Given alignment no power of 2");
+    exit(EXIT_FAILURE);
+  }
+
+  uintptr_t needed_size = (uintptr_t)hdr_size; 
+  uintptr_t align_mask = align - 1;
+  uintptr_t mod = ptr & align_mask;
+  uintptr_t padding = 0;
+
+  padding = align - mod;
+
+  if (padding < needed_size) {
+    needed_size -= padding;
+
+    if ((needed_size & align_mask) != 0) 
+      padding += align * (1 + needed_size / align);
+
+    else
+      padding += needed_size;
+  }
+  
+  return ptr + padding;
+}
+
+void stack_init(stack_t* s, void* buf, size_t size)
+{
+  VALIDATE_PTR(buf);
+
+  s->size = size;
+  s->curr_offset = 0;
+  s->curr_hdr = NULL;
+  s->buf = (unsigned char*)buf;
+  STATS_INIT(&s->stats);
+}
+
+void* stack_alloc_align(stack_t* s, size_t size, uintptr_t align)
+{
+  void* ptr = stack_alloc_nozero_align(s, size, align);
+  return ptr ? memset(ptr, 0, size) : NULL;
+}
+
+void* stack_alloc_nozero_align(stack_t* s, size_t size, uintptr_t align)
+{
+  VALIDATE_PTR(s, NULL);
+
+  uintptr_t curr_ptr = (uintptr_t)(s->buf + s->curr_offset);
+  uintptr_t offset_ptr = align_ptr_hdr(curr_ptr, align, sizeof(hdr_t));
+  offset_ptr -= (uintptr_t)s->buf;
+  size_t block_size = size + MEM_TRAILER_SIZE;
+
+  // ???
+  if ((size_t)offset_ptr + block_size > s->size) {
+    flog(LOG_ERROR, "Stack allocation out of bounds");
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned char* ptr = s->buf + offset_ptr;
+  hdr_t* header = (hdr_t*)(ptr - sizeof(hdr_t));
+
+#ifdef BASE_DEBUG
+  // The red zone of the previous element is extended up to the new header,
+  // which is where `stack_pop()` leaves the offset.
+  if (s->curr_hdr) {
+    stack_check_top(s, "stack_alloc");
+    unsigned char* top = (unsigned char*)s->curr_hdr + sizeof(hdr_t);
+    size_t top_size = mem_canary_check(top, (size_t)(s->buf + s->curr_offset - top), "stack_alloc");
+    mem_canary_set(top, top_size, (size_t)((unsigned char*)header - top));
+  }
+#endif
+
+  s->curr_offset = offset_ptr + block_size;
+  MEM_ASAN_UNPOISON(header, sizeof(hdr_t));
+  header->linked_hdr = s->curr_hdr;
+  s->curr_hdr = header;
+  STATS_ALLOC(&s->stats, 0);
+  STATS_USAGE(&s->stats, s->curr_offset);
+  TRACE(TRACE_ALLOC, TRACE_STACK, s, ptr, NULL, size, align);
+  mem_canary_set(ptr, size, block_size);
+
+  return mem_poison(ptr, size);
+}
+
+/// Resizes a stack element, extending or shrinking the last one in place.
+static void* stack_resize_impl(stack_t* s, void* element, size_t old_size, size_t new_size, uintptr_t align, bool zero)
+{
+  if (!element)
+    return zero ? stack_alloc_align(s, new_size, align) : stack_alloc_nozero_align(s, new_size, align);
+  
+  unsigned char* i = (unsigned char*)element;
+  
+  if (!within_bounds(i, s->buf, s->size)) {
+    flog(LOG_ERROR, "Resized stack element out of bounds");
+    exit(EXIT_FAILURE);
+  } 
+
+  bool is_last = s->curr_hdr && i == (unsigned char*)s->curr_hdr + sizeof(hdr_t);
+  size_t offset = (size_t)(i - s->buf);
+  size_t new_end = offset + new_size + MEM_TRAILER_SIZE;
+
+  if (is_last && new_end <= s->size) {
+#ifdef BASE_DEBUG
+    stack_check_top(s, "stack_resize_element");
+#endif
+    if (new_end < s->curr_offset)
+      MEM_ASAN_POISON(s->buf + new_end, s->curr_offset - new_end);
+
+    s->curr_offset = new_end;
+    STATS_USAGE(&s->stats, s->curr_offset);
+    TRACE(TRACE_RESIZE, TRACE_STACK, s, element, element, new_size, align);
+    mem_canary_set(element, new_size, new_size + MEM_TRAILER_SIZE);
+    
+    if (zero && new_size > old_size)
+      memset(i + old_size, 0, new_size - old_size);
+
+    return element;
+  }
+
+  if (new_size <= old_size) {
+    TRACE(TRACE_RESIZE, TRACE_STACK, s, element, element, new_size, align);
+    return element;
+  }
+
+  void* resized_element = zero ? stack_alloc_align(s, new_size, align) : stack_alloc_nozero_align(s, new_size, align);
+  memcpy(resized_element, element, old_size);
+
+  return resized_element;
+}
+
+void* stack_resize_element_align(stack_t* s, void* element, size_t old_size, size_t new_size, uintptr_t align)
+{
+  VALIDATE_PTR(s, NULL);
+
+  return stack_resize_impl(s, element, old_size, new_size, align, true);
+}
+
+void stack_check_top(stack_t* s, const char* func)
+{
+  VALIDATE_PTR(s);
+
+  hdr_t* hdr = s->curr_hdr;
+
+  if (!hdr)
+    return;
+
+  unsigned char* top = (unsigned char*)hdr + sizeof(hdr_t);
+  unsigned char* end = s->buf + s->curr_offset;
+  hdr_t* linked = hdr->linked_hdr;
+
+  if ((unsigned char*)hdr < s->buf || top > end || (linked && (linked >= hdr || (unsigned char*)linked < s->buf))) {
+    flog(LOG_ERROR, "%s(): header of the last element at %p was overwritten", func, (void*)hdr);
+    exit(EXIT_FAILURE);
+  }
+
+  mem_canary_check(top, (size_t)(end - top), func);
+}
+
+alloc_stats_t stack_stats(stack_t* s)
+{
+  alloc_stats_t stats = { 0 };
+
+  VALIDATE_PTR(s, stats);
+
+#ifdef BASE_STATS
+  stats = s->stats;
+#endif
+  stats.capacity = s->size;
+
+  return stats;
+}
+
+// Free slots hold the free list link and, in `BASE_DEBUG` builds, a mark
+// that gives away slots which are freed twice.
+#ifdef BASE_DEBUG
+  #define POOL_MIN_SLOT (2 * sizeof(hdr_t))
+#else
+  #define POOL_MIN_SLOT sizeof(hdr_t)
+#endif
+
+#define POOL_FREE_MARK ((uintptr_t)0xF7EEF7EEF7EEF7EEull)
+
+void pool_init_align(pool_t* p, void* buf, size_t size, size_t slot_size, uintptr_t align)
+{
+  VALIDATE_PTR(buf);
+
+  uintptr_t buf_zero = (uintptr_t)buf;
+  uintptr_t buf_zero_aligned = align_ptr(buf_zero, align);
+  size -= buf_zero_aligned - buf_zero;
+  slot_size = align_size(slot_size < POOL_MIN_SLOT ? POOL_MIN_SLOT : slot_size, align);
+  
+  p->size = size;
+  p->slot_size = slot_size;
+  p->curr_hdr = NULL;
+  p->bump_offset = 0;
+  p->buf = (unsigned char*)buf_zero_aligned;
+  p->slab_size = 0;
+  p->align = align;
+  p->partial = NULL;
+  p->full = NULL;
+  p->parent = NULL;
+  p->reclaim = false;
+  STATS_INIT(&p->stats);
+
+  pool_free_all(p);
+}
+
+void pool_init_growable_align(pool_t* p, size_t slot_size, size_t slab_size, arena_t* parent, bool reclaim, uintptr_t align)
+{
+  VALIDATE_PTR(p);
+
+  if (!is_pow2(align)) {
+    flog(LOG_ERROR, "pool_init_growable_align(): Given alignment no power of 2");
+    exit(EXIT_FAILURE);
+  }
+
+  slot_size = align_size(slot_size < POOL_MIN_SLOT ? POOL_MIN_SLOT : slot_size, align);
+  size_t slots_offset = align_size(sizeof(pool_slab_t), align);
+
+  if (slab_size < slots_offset + slot_size)
+    slab_size = slots_offset + slot_size;
+
+  if (!is_pow2(slab_size))
+    slab_size = (size_t)1 << (highest_bit(slab_size) + 1);
+
+  p->buf = NULL;
+  p->curr_hdr = NULL;
+  p->size = 0;
+  p->bump_offset = 0;
+  p->slot_size = slot_size;
+  p->slab_size = slab_size;
+  p->align = align;
+  p->partial = NULL;
+  p->full = NULL;
+  p->parent = parent;
+  p->reclaim = reclaim && !parent;
+  STATS_INIT(&p->stats);
+}
+
+static inline pool_slab_t* pool_slab_of(pool_t* p, void* slot)
+{
+  return (pool_slab_t*)((uintptr_t)slot & ~(uintptr_t)(p->slab_size - 1));
+}
+
+static inline unsigned char* pool_slab_slots(pool_t* p, pool_slab_t* slab)
+{
+  return (unsigned char*)slab + align_size(sizeof(pool_slab_t), p->align);
+}
+
+static void pool_slab_link(pool_slab_t** list, pool_slab_t* slab)
+{
+  slab->prev = NULL;
+  slab->next = *list;
+
+  if (*list)
+    (*list)->prev = slab;
+
+  *list = slab;
+}
+
+static void pool_slab_unlink(pool_slab_t** list, pool_slab_t* slab)
+{
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+
+  if (slab->next)
+    slab->next->prev = slab->prev;
+
+  slab->next = slab->prev = NULL;
+}
+
+static inline void pool_slab_reset(pool_t* p, pool_slab_t* slab)
+{
+  slab->free_hdr = NULL;
+  slab->used = 0;
+  slab->bump_offset = (size_t)(pool_slab_slots(p, slab) - (unsigned char*)slab);
+}
+
+static inline bool pool_slab_full(pool_t* p, pool_slab_t* slab)
+{
+  return !slab->free_hdr && slab->bump_offset + p->slot_size > p->slab_size;
+}
+
+/// Marks a slot as free in `BASE_DEBUG` builds. A slot that already carries the mark
+/// is looked up in the free list starting at `head`, and not freed again if it's there.
+/// @return False if the slot is free already.
+static bool pool_mark_free(hdr_t* head, void* slot)
+{
+#ifdef BASE_DEBUG
+  uintptr_t* mark = (uintptr_t*)slot + 1;
+
+  if (*mark == POOL_FREE_MARK) {
+    for (hdr_t* hdr = head; hdr; hdr = hdr->linked_hdr) {
+      if (hdr == (hdr_t*)slot) {
+        flog(LOG_WARNING, "Failed to free pool slot: %p is free already", slot);
+        return false;
+      }
+    }
+  }
+
+  *mark = POOL_FREE_MARK;
+#else
+  (void)head;
+  (void)slot;
+#endif
+
+  return true;
+}
+
+/// Poisons a free slot for AddressSanitizer, except for the link and the mark.
+static inline void pool_poison_slot(pool_t* p, void* slot)
+{
+  MEM_ASAN_POISON((unsigned char*)slot + POOL_MIN_SLOT, p->slot_size - POOL_MIN_SLOT);
+}
+
+#ifdef BASE_DEBUG
+
+/// Lists the slots handed out that don't carry the free mark.
+static void pool_report_leaks(pool_t* p, const char* func)
+{
+  leak_report_t report = { func, 0, 0 };
+
+  if (!p->slab_size) {
+    for (size_t offset = 0; offset < p->bump_offset; offset += p->slot_size) {
+      uintptr_t* slot = (uintptr_t*)(p->buf + offset);
+
+      if (slot[1] != POOL_FREE_MARK)
+        leak_report_add(&report, slot, p->slot_size);
+    }
+  }
+
+  pool_slab_t* lists[] = { p->partial, p->full };
+
+  for (size_t i = 0; i < 2 && p->slab_size; ++i) {
+    for (pool_slab_t* slab = lists[i]; slab; slab = slab->next) {
+      unsigned char* slots = pool_slab_slots(p, slab);
+
+      for (unsigned char* ptr = slots; ptr < (unsigned char*)slab + slab->bump_offset; ptr += p->slot_size) {
+        if (((uintptr_t*)ptr)[1] != POOL_FREE_MARK)
+          leak_report_add(&report, ptr, p->slot_size);
+      }
+    }
+  }
+
+  leak_report_end(&report);
+}
+
+#endif
+
+static pool_slab_t* pool_add_slab(pool_t* p)
+{
+  pool_slab_t* slab;
+
+  if (p->parent) {
+    slab = (pool_slab_t*)arena_alloc_nozero_align(p->parent, p->slab_size, p->slab_size);
+  } else {
+    slab = (pool_slab_t*)aligned_malloc(p->slab_size, p->slab_size);
+
+    if (!slab) {
+      flog(LOG_ERROR, "pool_alloc(): slab allocation failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  slab->pool = p;
+  pool_slab_reset(p, slab);
+  pool_slab_link(&p->partial, slab);
+  MEM_ASAN_POISON(pool_slab_slots(p, slab), p->slab_size - slab->bump_offset);
+  p->size += p->slab_size;
+
+  return slab;
+}
+
+static void pool_release_slab(pool_t* p, pool_slab_t* slab)
+{
+  p->size -= p->slab_size;
+  MEM_ASAN_UNPOISON(slab, p->slab_size);
+
+  if (!p->parent)
+    aligned_free(slab);
+}
+
+void* pool_alloc(pool_t* p)
+{
+  void* slot = pool_alloc_nozero(p);
+  return slot ? memset(slot, 0, p->slot_size) : NULL;
+}
+
+void* pool_alloc_nozero(pool_t* p)
+{
+  VALIDATE_PTR(p, NULL);
+
+  if (p->slab_size) {
+    pool_slab_t* slab = p->partial ? p->partial : pool_add_slab(p);
+    hdr_t* hdr = slab->free_hdr;
+
+    if (hdr) {
+      slab->free_hdr = hdr->linked_hdr;
+    } else {
+      hdr = (hdr_t*)((unsigned char*)slab + slab->bump_offset);
+      slab->bump_offset += p->slot_size;
+    }
+
+    ++slab->used;
+
+    if (pool_slab_full(p, slab)) {
+      pool_slab_unlink(&p->partial, slab);
+      pool_slab_link(&p->full, slab);
+    }
+
+    STATS_ALLOC(&p->stats, p->slot_size);
+    TRACE(TRACE_ALLOC, TRACE_POOL, p, hdr, NULL, p->slot_size, p->align);
+    MEM_ASAN_UNPOISON(hdr, p->slot_size);
+
+    return mem_poison(hdr, p->slot_size);
+  }
+
+  hdr_t* hdr = p->curr_hdr;
+
+  if (hdr) {
+    p->curr_hdr = hdr->linked_hdr;
+  } else if (p->bump_offset + p->slot_size <= p->size) {
+    hdr = (hdr_t*)(p->buf + p->bump_offset);
+    p->bump_offset += p->slot_size;
+  }
+
+  if (!hdr)
+    STATS_FAIL(&p->stats);
+
+  CHECK_PTR(hdr, NULL);
+  STATS_ALLOC(&p->stats, p->slot_size);
+  TRACE(TRACE_ALLOC, TRACE_POOL, p, hdr, NULL, p->slot_size, p->align);
+  MEM_ASAN_UNPOISON(hdr, p->slot_size);
+
+  return mem_poison(hdr, p->slot_size);
+}
+
+static inline bool pool_owns(pool_t* p, void* slot)
+{
+  unsigned char* ptr = (unsigned char*)slot;
+  return ptr >= p->buf && ptr < p->buf + p->bump_offset;
+}
+
+static size_t pool_alloc_n_impl(pool_t* p, void** slots, size_t n, bool zero)
+{
+  size_t count = 0;
+
+  if (p->slab_size) {
+    while (count < n) {
+      pool_slab_t* slab = p->partial ? p->partial : pool_add_slab(p);
+      size_t first = count;
+
+      for (hdr_t* hdr = slab->free_hdr; hdr && count < n; hdr = slab->free_hdr) {
+        slab->free_hdr = hdr->linked_hdr;
+        slots[count++] = hdr;
+      }
+
+      for (; count < n && slab->bump_offset + p->slot_size <= p->slab_size; ++count) {
+        slots[count] = (unsigned char*)slab + slab->bump_offset;
+        slab->bump_offset += p->slot_size;
+      }
+
+      slab->used += count - first;
+
+      if (pool_slab_full(p, slab)) {
+        pool_slab_unlink(&p->partial, slab);
+        pool_slab_link(&p->full, slab);
+      }
+    }
+  } else {
+    for (hdr_t* hdr = p->curr_hdr; hdr && count < n; hdr = p->curr_hdr) {
+      p->curr_hdr = hdr->linked_hdr;
+      slots[count++] = hdr;
+    }
+
+    for (; count < n && p->bump_offset + p->slot_size <= p->size; ++count) {
+      slots[count] = p->buf + p->bump_offset;
+      p->bump_offset += p->slot_size;
+    }
+
+    if (count < n) {
+      STATS_FAIL(&p->stats);
+      flog(LOG_WARNING, "pool_alloc_n(): pool exhausted after %zu of %zu slots", count, n);
+    }
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    STATS_ALLOC(&p->stats, p->slot_size);
+    TRACE(TRACE_ALLOC, TRACE_POOL, p, slots[i], NULL, p->slot_size, p->align);
+    MEM_ASAN_UNPOISON(slots[i], p->slot_size);
+
+    if (zero)
+      memset(slots[i], 0, p->slot_size);
+    else
+      mem_poison(slots[i], p->slot_size);
+  }
+
+  return count;
+}
+
+size_t pool_alloc_n(pool_t* p, void** slots, size_t n)
+{
+  VALIDATE_PTR(p, 0);
+  VALIDATE_PTR(slots, 0);
+
+  return pool_alloc_n_impl(p, slots, n, true);
+}
+
+size_t pool_alloc_n_nozero(pool_t* p, void** slots, size_t n)
+{
+  VALIDATE_PTR(p, 0);
+  VALIDATE_PTR(slots, 0);
+
+  return pool_alloc_n_impl(p, slots, n, false);
+}
+
+/// Checks that `slot` was handed out by one of the slabs of `p`. The slab header
+/// is only read after the slab was found in the pool's lists in `BASE_DEBUG` builds.
+/// Otherwise the header is read right away, which faults if a foreign address
+/// lies in unmapped memory. Walking the lists on every free would make it linear
+/// in the number of slabs, which `gpa_free()` can't afford.
+static bool pool_slab_owns(pool_t* p, pool_slab_t* slab, void* slot)
+{
+#ifdef BASE_DEBUG
+  bool listed = false;
+  pool_slab_t* lists[] = { p->partial, p->full };
+
+  for (size_t i = 0; i < 2 && !listed; ++i) {
+    for (pool_slab_t* it = lists[i]; it && !listed; it = it->next)
+      listed = it == slab;
+  }
+
+  if (!listed)
+    return false;
+#endif
+
+  if (slab->pool != p)
+    return false;
+
+  unsigned char* slots = pool_slab_slots(p, slab);
+  unsigned char* ptr = (unsigned char*)slot;
+
+  return ptr >= slots && ptr < (unsigned char*)slab + slab->bump_offset &&
+         (size_t)(ptr - slots) % p->slot_size == 0;
+}
+
+static void pool_free_growable(pool_t* p, void* slot)
+{
+  pool_slab_t* slab = pool_slab_of(p, slot);
+
+  if (!pool_slab_owns(p, slab, slot)) {
+    flog(LOG_WARNING, "Failed to free pool slot: Given address not owned by the pool");
+    return;
+  }
+
+  if (!pool_mark_free(slab->free_hdr, slot))
+    return;
+
+  bool was_full = pool_slab_full(p, slab);
+  STATS_FREE(&p->stats, p->slot_size);
+  TRACE(TRACE_FREE, TRACE_POOL, p, slot, NULL, p->slot_size, 0);
+
+  hdr_t* hdr = (hdr_t*)slot;
+  hdr->linked_hdr = slab->free_hdr;
+  slab->free_hdr = hdr;
+  --slab->used;
+  pool_poison_slot(p, slot);
+
+  if (was_full) {
+    pool_slab_unlink(&p->full, slab);
+    pool_slab_link(&p->partial, slab);
+  }
+
+  // Keep at least one slab with free slots around, so that a single
+  // alloc/free pair at the border of a slab doesn't hit the heap each time.
+  if (p->reclaim && !slab->used && (slab->prev || slab->next)) {
+    pool_slab_unlink(&p->partial, slab);
+    pool_release_slab(p, slab);
+  }
+}
+
+void pool_free(pool_t* p, void* slot)
+{
+  VALIDATE_PTR(p);
+  CHECK_PTR(slot);
+
+  if (p->slab_size) {
+    pool_free_growable(p, slot);
+    return;
+  }
+
+  if (!pool_owns(p, slot)) {
+    flog(LOG_WARNING, "Failed to free pool slot: Given address out of bounds");
+    return;
+  }
+
+  if (!pool_mark_free(p->curr_hdr, slot))
+    return;
+
+  hdr_t* hdr = (hdr_t*)slot;
+  hdr->linked_hdr = p->curr_hdr;
+  p->curr_hdr = hdr;
+  pool_poison_slot(p, slot);
+  STATS_FREE(&p->stats, p->slot_size);
+  TRACE(TRACE_FREE, TRACE_POOL, p, slot, NULL, p->slot_size, 0);
+  slot = NULL;
+}
+
+void pool_free_n(pool_t* p, void** slots, size_t n)
+{
+  VALIDATE_PTR(p);
+  VALIDATE_PTR(slots);
+
+  if (p->slab_size) {
+    for (size_t i = 0; i < n; ++i)
+      pool_free_growable(p, slots[i]);
+    return;
+  }
+
+  hdr_t* head = p->curr_hdr;
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!pool_owns(p, slots[i])) {
+      flog(LOG_WARNING, "Failed to free pool slot: Given address out of bounds");
+      continue;
+    }
+
+    if (!pool_mark_free(head, slots[i]))
+      continue;
+
+    hdr_t* hdr = (hdr_t*)slots[i];
+    hdr->linked_hdr = head;
+    head = hdr;
+    pool_poison_slot(p, hdr);
+    STATS_FREE(&p->stats, p->slot_size);
+    TRACE(TRACE_FREE, TRACE_POOL, p, hdr, NULL, p->slot_size, 0);
+  }
+
+  p->curr_hdr = head;
+}
+
+void pool_free_chain(pool_t* p, void* first, void* last)
+{
+  VALIDATE_PTR(p);
+  VALIDATE_PTR(first);
+  VALIDATE_PTR(last);
+
+  if (p->slab_size) {
+    hdr_t* hdr = (hdr_t*)first;
+
+    for (;;) {
+      hdr_t* next = hdr->linked_hdr;
+      pool_free_growable(p, hdr);
+
+      if (hdr == (hdr_t*)last)
+        break;
+
+      hdr = next;
+    }
+
+    return;
+  }
+
+  if (!pool_owns(p, first) || !pool_owns(p, last)) {
+    flog(LOG_WARNING, "Failed to free pool chain: Given address out of bounds");
+    return;
+  }
+
+#ifdef BASE_DEBUG
+  for (hdr_t* hdr = (hdr_t*)first;; hdr = hdr->linked_hdr) {
+    if (!pool_mark_free(p->curr_hdr, hdr))
+      return;
+
+    if (hdr == (hdr_t*)last)
+      break;
+  }
+#endif
+
+#if defined(BASE_STATS) || defined(BASE_TRACE) || defined(BASE_DEBUG)
+  for (hdr_t* hdr = (hdr_t*)first;; hdr = hdr->linked_hdr) {
+    STATS_FREE(&p->stats, p->slot_size);
+    TRACE(TRACE_FREE, TRACE_POOL, p, hdr, NULL, p->slot_size, 0);
+    pool_poison_slot(p, hdr);
+
+    if (hdr == (hdr_t*)last)
+      break;
+  }
+#endif
+
+  ((hdr_t*)last)->linked_hdr = p->curr_hdr;
+  p->curr_hdr = (hdr_t*)first;
+}
+
+void pool_free_all(pool_t* p)
+{
+  VALIDATE_PTR(p);
+
+#ifdef BASE_DEBUG
+  pool_report_leaks(p, "pool_free_all");
+#endif
+  STATS_USAGE(&p->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_POOL, p, NULL, NULL, 0, 0);
+
+  if (p->slab_size) {
+    while (p->full) {
+      pool_slab_t* slab = p->full;
+      pool_slab_unlink(&p->full, slab);
+      pool_slab_link(&p->partial, slab);
+    }
+
+    for (pool_slab_t* slab = p->partial; slab;) {
+      pool_slab_t* next = slab->next;
+
+      if (p->reclaim && slab != p->partial) {
+        pool_slab_unlink(&p->partial, slab);
+        pool_release_slab(p, slab);
+      } else {
+        pool_slab_reset(p, slab);
+        MEM_ASAN_POISON(pool_slab_slots(p, slab), p->slab_size - slab->bump_offset);
+      }
+
+      slab = next;
+    }
+
+    return;
+  }
+
+  p->curr_hdr = NULL;
+  p->bump_offset = 0;
+  MEM_ASAN_POISON(p->buf, p->size);
+}
+
+void pool_release(pool_t* p)
+{
+  VALIDATE_PTR(p);
+
+  if (!p->slab_size) {
+    pool_free_all(p);
+    MEM_ASAN_UNPOISON(p->buf, p->size);
+    return;
+  }
+
+#ifdef BASE_DEBUG
+  pool_report_leaks(p, "pool_release");
+#endif
+
+  pool_slab_t* lists[] = { p->partial, p->full };
+
+  for (size_t i = 0; i < 2; ++i) {
+    for (pool_slab_t* slab = lists[i]; slab;) {
+      pool_slab_t* next = slab->next;
+      pool_release_slab(p, slab);
+      slab = next;
+    }
+  }
+
+  p->partial = NULL;
+  p->full = NULL;
+  STATS_USAGE(&p->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_POOL, p, NULL, NULL, 0, 0);
+}
+
+alloc_stats_t pool_stats(pool_t* p)
+{
+  alloc_stats_t stats = { 0 };
+
+  VALIDATE_PTR(p, stats);
+
+#ifdef BASE_STATS
+  stats = p->stats;
+#endif
+  stats.capacity = p->size;
+
+  return stats;
+}
+
+#define CPOOL_NIL UINT32_MAX
+#define CPOOL_BATCH (CPOOL_MAGAZINE_SIZE / 2)
+
+typedef struct cpool_mag {
+  cpool_t* pool;
+  uint64_t id;
+  uint32_t count;
+  void* slots[CPOOL_MAGAZINE_SIZE];
+} cpool_mag_t;
+
+static atomic_uint_fast64_t cpool_next_id = 1;
+static THREAD_LOCAL cpool_mag_t cpool_mags[CPOOL_THREAD_CACHES];
+
+static inline _Atomic(uint32_t)* cpool_link(cpool_t* p, uint32_t index)
+{
+  return (_Atomic(uint32_t)*)(p->buf + (size_t)index * p->slot_size);
+}
+
+static inline uint32_t cpool_index(cpool_t* p, void* slot)
+{
+  return (uint32_t)((size_t)((unsigned char*)slot - p->buf) / p->slot_size);
+}
+
+/// Pops up to `max` slots off the shared stack with a single CAS.
+static uint32_t cpool_pop_batch(cpool_t* p, void** slots, uint32_t max)
+{
+  uint64_t head = atomic_load_explicit(&p->head, memory_order_acquire);
+
+  for (;;) {
+    uint32_t index = (uint32_t)head;
+    uint32_t count = 0;
+
+    // Links may be overwritten by a concurrent owner; the CAS below fails in that case.
+    while (index < p->slot_count && count < max) {
+      slots[count++] = p->buf + (size_t)index * p->slot_size;
+      index = atomic_load_explicit(cpool_link(p, index), memory_order_relaxed);
+    }
+
+    if (count == 0)
+      return 0;
+
+    if (index >= p->slot_count)
+      index = CPOOL_NIL;
+
+    uint64_t new_head = (((head >> 32) + 1) << 32) | index;
+
+    if (atomic_compare_exchange_weak_explicit(&p->head, &head, new_head,
+        memory_order_acq_rel, memory_order_acquire))
+      return count;
+  }
+}
+
+/// Claims up to `max` untouched slots from the bump index.
+static uint32_t cpool_bump_batch(cpool_t* p, void** slots, uint32_t max)
+{
+  uint32_t first = atomic_load_explicit(&p->bump, memory_order_relaxed);
+  uint32_t count;
+
+  do {
+    if (first >= p->slot_count)
+      return 0;
+
+    count = p->slot_count - first < max ? p->slot_count - first : max;
+  } while (!atomic_compare_exchange_weak_explicit(&p->bump, &first, first + count,
+      memory_order_relaxed, memory_order_relaxed));
+
+  for (uint32_t i = 0; i < count; ++i)
+    slots[i] = p->buf + (size_t)(first + i) * p->slot_size;
+
+  return count;
+}
+
+/// Pushes `count` slots onto the shared stack with a single CAS.
+static void cpool_push_batch(cpool_t* p, void** slots, uint32_t count)
+{
+  if (count == 0)
+    return;
+
+  for (uint32_t i = 0; i + 1 < count; ++i)
+    atomic_store_explicit(cpool_link(p, cpool_index(p, slots[i])), cpool_index(p, slots[i + 1]), memory_order_relaxed);
+
+  uint32_t first = cpool_index(p, slots[0]);
+  _Atomic(uint32_t)* last_link = cpool_link(p, cpool_index(p, slots[count - 1]));
+  uint64_t head = atomic_load_explicit(&p->head, memory_order_relaxed);
+  uint64_t new_head;
+
+  do {
+    atomic_store_explicit(last_link, (uint32_t)head, memory_order_relaxed);
+    new_head = (((head >> 32) + 1) << 32) | first;
+  } while (!atomic_compare_exchange_weak_explicit(&p->head, &head, new_head,
+      memory_order_release, memory_order_relaxed));
+}
+
+/// Returns the calling thread's magazine for the pool, flushing whatever pool it cached before.
+static cpool_mag_t* cpool_mag_get(cpool_t* p)
+{
+  cpool_mag_t* mag = &cpool_mags[((uintptr_t)p / CACHE_LINE_SIZE) % CPOOL_THREAD_CACHES];
+
+  if (mag->pool == p && mag->id == p->id)
+    return mag;
+
+  if (mag->pool && mag->id == mag->pool->id)
+    cpool_push_batch(mag->pool, mag->slots, mag->count);
+
+  mag->pool = p;
+  mag->id = p->id;
+  mag->count = 0;
+
+  return mag;
+}
+
+void cpool_init_align(cpool_t* p, void* buf, size_t size, size_t slot_size, uintptr_t align)
+{
+  VALIDATE_PTR(p);
+  VALIDATE_PTR(buf);
+
+  uintptr_t buf_zero = (uintptr_t)buf;
+  uintptr_t buf_zero_aligned = align_ptr(buf_zero, align);
+  size -= buf_zero_aligned - buf_zero;
+  slot_size = align_size(slot_size < sizeof(uint32_t) ? sizeof(uint32_t) : slot_size, align);
+
+  size_t slot_count = size / slot_size;
+
+  if (slot_count >= CPOOL_NIL) {
+    flog(LOG_WARNING, "cpool_init_align(): pool limited to %u slots", CPOOL_NIL - 1);
+    slot_count = CPOOL_NIL - 1;
+  }
+
+  p->buf = (unsigned char*)buf_zero_aligned;
+  p->size = size;
+  p->slot_size = slot_size;
+  p->slot_count = (uint32_t)slot_count;
+
+  cpool_free_all(p);
+}
+
+void cpool_free_all(cpool_t* p)
+{
+  VALIDATE_PTR(p);
+
+  // A new id invalidates the magazines of all threads.
+  p->id = atomic_fetch_add(&cpool_next_id, 1);
+  atomic_store(&p->head, CPOOL_NIL);
+  atomic_store(&p->bump, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_CPOOL, p, NULL, NULL, 0, 0);
+}
+
+void* cpool_alloc(cpool_t* p)
+{
+  void* slot = cpool_alloc_nozero(p);
+  return slot ? memset(slot, 0, p->slot_size) : NULL;
+}
+
+void* cpool_alloc_nozero(cpool_t* p)
+{
+  VALIDATE_PTR(p, NULL);
+
+  cpool_mag_t* mag = cpool_mag_get(p);
+
+  if (mag->count == 0)
+    mag->count = cpool_pop_batch(p, mag->slots, CPOOL_BATCH);
+
+  if (mag->count == 0)
+    mag->count = cpool_bump_batch(p, mag->slots, CPOOL_BATCH);
+
+  if (mag->count == 0) {
+    flog(LOG_WARNING, "cpool_alloc(): pool exhausted");
+    return NULL;
+  }
+
+  void* slot = mag->slots[--mag->count];
+  TRACE(TRACE_ALLOC, TRACE_CPOOL, p, slot, NULL, p->slot_size, 0);
+
+  return mem_poison(slot, p->slot_size);
+}
+
+void cpool_free(cpool_t* p, void* slot)
+{
+  VALIDATE_PTR(p);
+  CHECK_PTR(slot);
+
+  unsigned char* ptr = (unsigned char*)slot;
+
+  if (ptr < p->buf || ptr >= p->buf + (size_t)p->slot_count * p->slot_size) {
+    flog(LOG_WARNING, "Failed to free concurrent pool slot: Given address out of bounds");
+    return;
+  }
+
+  TRACE(TRACE_FREE, TRACE_CPOOL, p, slot, NULL, p->slot_size, 0);
+  cpool_mag_t* mag = cpool_mag_get(p);
+
+  if (mag->count == CPOOL_MAGAZINE_SIZE) {
+    mag->count -= CPOOL_BATCH;
+    cpool_push_batch(p, mag->slots + mag->count, CPOOL_BATCH);
+  }
+
+  mag->slots[mag->count++] = slot;
+}
+
+void cpool_thread_flush(void)
+{
+  for (size_t i = 0; i < CPOOL_THREAD_CACHES; ++i) {
+    cpool_mag_t* mag = &cpool_mags[i];
+
+    if (mag->pool && mag->id == mag->pool->id)
+      cpool_push_batch(mag->pool, mag->slots, mag->count);
+
+    mag->pool = NULL;
+    mag->count = 0;
+  }
+}
+
+void free_list_init_align(free_list_t* fl, void* buf, size_t size, uintptr_t align)
+{
+  uintptr_t buf_zero = (uintptr_t)buf;
+  uintptr_t buf_zero_aligned = align_ptr(buf_zero, align);
+  uintptr_t diff = buf_zero_aligned - buf_zero; 
+  
+  fl->buf = (unsigned char*)buf_zero_aligned;
+  fl->size = size - diff;
 
   fl_hdr_t* first_hdr = fl_first_hdr(fl);
   size_t hdr_size = align_size(sizeof(fl_hdr_t), align);
+  MEM_ASAN_UNPOISON(fl->buf, fl->size);
   first_hdr->linked_hdr = NULL;
-  first_hdr->block_size = size - hdr_size;
+  first_hdr->prev_hdr = NULL;
+  first_hdr->block_size = fl->size - hdr_size;
+  MEM_ASAN_POISON(fl->buf + hdr_size, first_hdr->block_size);
+  STATS_INIT(&fl->stats);
 }
 
 void* free_list_alloc_align(free_list_t* fl, size_t size, fl_policy policy, uintptr_t align)
+{
+  void* ptr = free_list_alloc_nozero_align(fl, size, policy, align);
+  return ptr ? memset(ptr, 0, size) : NULL;
+}
+
+void* free_list_alloc_nozero_align(free_list_t* fl, size_t size, fl_policy policy, uintptr_t align)
 {
   VALIDATE_PTR(fl, NULL);
   
   fl_hdr_t* hdr = NULL;
   fl_hdr_t* prev_hdr = NULL;
 
-  size_t aligned_size = align_size(size, align);
+  size_t aligned_size = align_size(size + MEM_TRAILER_SIZE, align);
   
   switch (policy) {
     case FIRST_SLOT:
@@ -433,7 +1981,10 @@ void* free_list_alloc_align(free_list_t* fl, size_t size, fl_policy policy, uint
     break;
   }
 
-  VALIDATE_PTR(hdr, NULL);
+  if (!hdr)
+    STATS_FAIL(&fl->stats);
+
+  CHECK_PTR(hdr, NULL);
 
   hdr->block_size = 0;
 
@@ -453,14 +2004,62 @@ void* free_list_alloc_align(free_list_t* fl, size_t size, fl_policy policy, uint
   // to the given alignment left.
   if (space_left >= ((uintptr_t)hdr_size + align)) {
     fl_hdr_t* new_hdr = (fl_hdr_t*)(aligned_block_end);
+    MEM_ASAN_UNPOISON(new_hdr, sizeof(fl_hdr_t));
     new_hdr->block_size = space_left - hdr_size;
     new_hdr->linked_hdr = hdr->linked_hdr;
+    new_hdr->prev_hdr = hdr;
+
+    if (new_hdr->linked_hdr)
+      new_hdr->linked_hdr->prev_hdr = new_hdr;
+
     hdr->linked_hdr = new_hdr; 
   }
 
-  return memset(ptr, 0, size);
+  uintptr_t block_end = hdr->linked_hdr ? (uintptr_t)hdr->linked_hdr : (uintptr_t)(fl->buf + fl->size);
+  STATS_ALLOC(&fl->stats, (size_t)(block_end - (uintptr_t)ptr));
+  TRACE(TRACE_ALLOC, TRACE_FREE_LIST, fl, ptr, NULL, size, align);
+  mem_canary_set(ptr, size, (size_t)(block_end - (uintptr_t)ptr));
+
+  return mem_poison(ptr, size);
+}
+
+#ifdef BASE_DEBUG
+
+/// Checks that the header is linked with its neighbors, which fails if it was
+/// overwritten or if no block starts behind it.
+static bool free_list_hdr_valid(free_list_t* fl, fl_hdr_t* hdr)
+{
+  unsigned char* ptr = (unsigned char*)hdr;
+  unsigned char* next = (unsigned char*)hdr->linked_hdr;
+  unsigned char* prev = (unsigned char*)hdr->prev_hdr;
+
+  if (next && (next <= ptr || next >= fl->buf + fl->size))
+    return false;
+
+  if (prev ? (prev >= ptr || prev < fl->buf) : hdr != fl_first_hdr(fl))
+    return false;
+
+  return (!next || hdr->linked_hdr->prev_hdr == hdr) && (!prev || hdr->prev_hdr->linked_hdr == hdr);
+}
+
+/// Lists the blocks in use.
+static void free_list_report_leaks(free_list_t* fl, size_t hdr_size, const char* func)
+{
+  leak_report_t report = { func, 0, 0 };
+
+  for (fl_hdr_t* hdr = fl_first_hdr(fl); hdr; hdr = hdr->linked_hdr) {
+    unsigned char* ptr = (unsigned char*)hdr + hdr_size;
+    unsigned char* end = hdr->linked_hdr ? (unsigned char*)hdr->linked_hdr : fl->buf + fl->size;
+
+    if (hdr->block_size == 0)
+      leak_report_add(&report, ptr, mem_canary_check(ptr, (size_t)(end - ptr), func));
+  }
+
+  leak_report_end(&report);
 }
 
+#endif
+
 void free_list_free_align(free_list_t* fl, void* element, size_t element_size, uintptr_t align) {
   uintptr_t hdr_size = align_size(sizeof(fl_hdr_t), align);
 
@@ -472,8 +2071,35 @@ void free_list_free_align(free_list_t* fl, void* element, size_t element_size, u
   }
   
   fl_hdr_t* hdr = (fl_hdr_t*)((uintptr_t)element - hdr_size);
-  
-  hdr->block_size += align_size(element_size, align);
+
+  if (hdr->block_size > 0) {
+    flog(LOG_WARNING, "free_list_free: element %p is already free", element);
+    return;
+  }
+
+#ifdef BASE_DEBUG
+  if (!free_list_hdr_valid(fl, hdr)) {
+    flog(LOG_ERROR, "free_list_free: no block starts at %p, or its header was overwritten", element);
+    exit(EXIT_FAILURE);
+  }
+#endif
+
+  // The block reaches up to the next header, or the end of the buffer.
+  uintptr_t block_end = hdr->linked_hdr ? (uintptr_t)hdr->linked_hdr : (uintptr_t)(fl->buf + fl->size);
+
+#ifdef BASE_DEBUG
+  size_t requested = mem_canary_check(element, (size_t)(block_end - (uintptr_t)element), "free_list_free");
+
+  if (element_size > 0 && element_size != requested)
+    flog(LOG_WARNING, "free_list_free: given size %zu doesn't match the %zu bytes allocated", element_size, requested);
+#endif
+
+  hdr->block_size = (size_t)(block_end - (uintptr_t)element);
+  STATS_FREE(&fl->stats, hdr->block_size);
+  TRACE(TRACE_FREE, TRACE_FREE_LIST, fl, element, NULL, element_size, 0);
+
+  if (align_size(element_size, align) > hdr->block_size)
+    flog(LOG_WARNING, "free_list_free: given size %zu exceeds the block size %zu", element_size, hdr->block_size);
 
   fl_hdr_t* linked_hdr = hdr->linked_hdr;
 
@@ -481,23 +2107,25 @@ void free_list_free_align(free_list_t* fl, void* element, size_t element_size, u
   if (linked_hdr && linked_hdr->block_size > 0) {
     hdr->block_size += hdr_size + linked_hdr->block_size;
     hdr->linked_hdr = linked_hdr->linked_hdr;
+
+    if (hdr->linked_hdr)
+      hdr->linked_hdr->prev_hdr = hdr;
   }
 
   // Try to merge into the previous block.
-  fl_hdr_t* prev_hdr = NULL;
-  fl_hdr_t* nhdr = fl_first_hdr(fl);
-
-  while (nhdr) {
-    if (nhdr >= hdr) break;
-
-    prev_hdr = nhdr;
-    nhdr = nhdr->linked_hdr;
-  }
+  fl_hdr_t* prev_hdr = hdr->prev_hdr;
   
   if (prev_hdr && prev_hdr->block_size > 0) {
     prev_hdr->block_size += hdr_size + hdr->block_size;
     prev_hdr->linked_hdr = hdr->linked_hdr;
+
+    if (prev_hdr->linked_hdr)
+      prev_hdr->linked_hdr->prev_hdr = prev_hdr;
+
+    hdr = prev_hdr;
   }
+
+  MEM_ASAN_POISON((unsigned char*)hdr + hdr_size, hdr->block_size);
 }
 
 void free_list_free_all_align(free_list_t* fl, uintptr_t align)
@@ -507,8 +2135,35 @@ void free_list_free_all_align(free_list_t* fl, uintptr_t align)
   fl_hdr_t* first_hdr = fl_first_hdr(fl);
   size_t hdr_size = (size_t)align_size(sizeof(fl_hdr_t), align);
 
+#ifdef BASE_DEBUG
+  free_list_report_leaks(fl, hdr_size, "free_list_free_all");
+#endif
+
   first_hdr->block_size = fl->size - hdr_size;
   first_hdr->linked_hdr = NULL;
+  first_hdr->prev_hdr = NULL;
+  MEM_ASAN_POISON(fl->buf + hdr_size, first_hdr->block_size);
+  STATS_USAGE(&fl->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_FREE_LIST, fl, NULL, NULL, 0, 0);
+}
+
+alloc_stats_t free_list_stats(free_list_t* fl)
+{
+  alloc_stats_t stats = { 0 };
+
+  VALIDATE_PTR(fl, stats);
+
+#ifdef BASE_STATS
+  stats = fl->stats;
+#endif
+  stats.capacity = fl->size;
+
+  for (fl_hdr_t* hdr = fl_first_hdr(fl); hdr; hdr = hdr->linked_hdr) {
+    if (hdr->block_size > 0)
+      alloc_stats_free_block(&stats, hdr->block_size);
+  }
+
+  return stats;
 }
 
 void free_list_find_first(free_list_t* fl, size_t size, fl_hdr_t** found_hdr, fl_hdr_t** prev_hdr)
@@ -553,3 +2208,539 @@ void free_list_find_best(free_list_t* fl, size_t size, fl_hdr_t** found_hdr, fl_
     hdr = hdr->linked_hdr;
   }
 }
+
+// Block sizes are multiples of TLSF_ALIGN, the lowest bit marks free blocks.
+#define TLSF_ALIGN_LOG2 4
+#define TLSF_ALIGN ((size_t)1 << TLSF_ALIGN_LOG2)
+#define TLSF_HDR_SIZE (2 * sizeof(void*))
+#define TLSF_MIN_SIZE (2 * sizeof(void*))
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_SMALL_BLOCK ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_FREE_BIT ((size_t)1)
+
+static inline size_t tlsf_size(tlsf_block_t* b)
+{
+  return b->size & ~TLSF_FREE_BIT;
+}
+
+static inline bool tlsf_is_free(tlsf_block_t* b)
+{
+  return (b->size & TLSF_FREE_BIT) != 0;
+}
+
+static inline tlsf_block_t* tlsf_next_phys(tlsf_block_t* b)
+{
+  return (tlsf_block_t*)((unsigned char*)b + TLSF_HDR_SIZE + tlsf_size(b));
+}
+
+static inline tlsf_block_t* tlsf_from_ptr(void* ptr)
+{
+  return (tlsf_block_t*)((unsigned char*)ptr - TLSF_HDR_SIZE);
+}
+
+static void tlsf_mapping(size_t size, unsigned* fl, unsigned* sl)
+{
+  if (size < TLSF_SMALL_BLOCK) {
+    *fl = 0;
+    *sl = (unsigned)(size / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT));
+    return;
+  }
+
+  unsigned high = highest_bit(size);
+  *sl = (unsigned)(size >> (high - TLSF_SL_LOG2)) ^ (1u << TLSF_SL_LOG2);
+  *fl = high - (TLSF_FL_SHIFT - 1);
+}
+
+static void tlsf_insert(tlsf_t* t, tlsf_block_t* b)
+{
+  unsigned fl, sl;
+  tlsf_mapping(tlsf_size(b), &fl, &sl);
+
+  tlsf_block_t* head = t->free_lists[fl][sl];
+  b->next_free = head;
+  b->prev_free = NULL;
+
+  if (head)
+    head->prev_free = b;
+
+  t->free_lists[fl][sl] = b;
+  t->fl_bitmap |= (uint64_t)1 << fl;
+  t->sl_bitmap[fl] |= 1u << sl;
+
+  // Everything but the links of a free block is poisoned.
+  MEM_ASAN_POISON((unsigned char*)b + TLSF_HDR_SIZE + TLSF_MIN_SIZE, tlsf_size(b) - TLSF_MIN_SIZE);
+}
+
+static void tlsf_remove(tlsf_t* t, tlsf_block_t* b)
+{
+  unsigned fl, sl;
+  tlsf_mapping(tlsf_size(b), &fl, &sl);
+
+  if (b->next_free)
+    b->next_free->prev_free = b->prev_free;
+
+  if (b->prev_free)
+    b->prev_free->next_free = b->next_free;
+
+  else {
+    t->free_lists[fl][sl] = b->next_free;
+
+    if (!b->next_free) {
+      t->sl_bitmap[fl] &= ~(1u << sl);
+
+      if (!t->sl_bitmap[fl])
+        t->fl_bitmap &= ~((uint64_t)1 << fl);
+    }
+  }
+}
+
+/// Finds and unlinks a free block of at least `size` bytes, or returns null.
+static tlsf_block_t* tlsf_locate(tlsf_t* t, size_t size)
+{
+  // Round up to the next list start, so every block in the found list fits.
+  if (size >= TLSF_SMALL_BLOCK)
+    size += ((size_t)1 << (highest_bit(size) - TLSF_SL_LOG2)) - 1;
+
+  unsigned fl, sl;
+  tlsf_mapping(size, &fl, &sl);
+
+  if (fl >= TLSF_FL_COUNT)
+    return NULL;
+
+  uint32_t sl_map = t->sl_bitmap[fl] & (~0u << sl);
+
+  if (!sl_map) {
+    uint64_t fl_map = fl + 1 < TLSF_FL_COUNT ? t->fl_bitmap & (~(uint64_t)0 << (fl + 1)) : 0;
+
+    if (!fl_map)
+      return NULL;
+
+    fl = lowest_bit(fl_map);
+    sl_map = t->sl_bitmap[fl];
+  }
+
+  sl = lowest_bit(sl_map);
+  tlsf_block_t* b = t->free_lists[fl][sl];
+  tlsf_remove(t, b);
+
+  return b;
+}
+
+/// Splits off the part of a block beyond `size` bytes as a new free block, if it's large enough.
+static void tlsf_trim(tlsf_t* t, tlsf_block_t* b, size_t size)
+{
+  size_t block_size = tlsf_size(b);
+
+  if (block_size < size + TLSF_HDR_SIZE + TLSF_MIN_SIZE)
+    return;
+
+  tlsf_block_t* rest = (tlsf_block_t*)((unsigned char*)b + TLSF_HDR_SIZE + size);
+  rest->size = (block_size - size - TLSF_HDR_SIZE) | TLSF_FREE_BIT;
+  rest->prev_phys = b;
+  tlsf_next_phys(rest)->prev_phys = rest;
+
+  b->size = size | (b->size & TLSF_FREE_BIT);
+
+  // The block after `rest` is in use, otherwise it would have been merged.
+  tlsf_insert(t, rest);
+}
+
+/// Turns the whole buffer into one free block again.
+static void tlsf_reset(tlsf_t* t)
+{
+  memset(t->free_lists, 0, sizeof(t->free_lists));
+  memset(t->sl_bitmap, 0, sizeof(t->sl_bitmap));
+  t->fl_bitmap = 0;
+
+  if (!t->buf)
+    return;
+
+  MEM_ASAN_UNPOISON(t->buf, t->size);
+
+  // One free block spanning the buffer, followed by an empty sentinel block in use.
+  tlsf_block_t* first = (tlsf_block_t*)t->buf;
+  first->prev_phys = NULL;
+  first->size = (t->size - 2 * TLSF_HDR_SIZE) | TLSF_FREE_BIT;
+
+  tlsf_block_t* sentinel = tlsf_next_phys(first);
+  sentinel->prev_phys = first;
+  sentinel->size = 0;
+
+  tlsf_insert(t, first);
+}
+
+void tlsf_init(tlsf_t* t, void* buf, size_t size)
+{
+  VALIDATE_PTR(t);
+  VALIDATE_PTR(buf);
+
+  STATS_INIT(&t->stats);
+
+  uintptr_t buf_zero = (uintptr_t)buf;
+  uintptr_t buf_zero_aligned = align_ptr(buf_zero, TLSF_ALIGN);
+  size_t diff = (size_t)(buf_zero_aligned - buf_zero);
+
+  if (size < diff + 2 * TLSF_HDR_SIZE + TLSF_MIN_SIZE) {
+    flog(LOG_WARNING, "tlsf_init(): buffer of %zu bytes too small", size);
+    t->buf = NULL;
+    t->size = 0;
+  } else {
+    t->buf = (unsigned char*)buf_zero_aligned;
+    t->size = (size - diff) & ~(TLSF_ALIGN - 1);
+  }
+
+  tlsf_reset(t);
+}
+
+#ifdef BASE_DEBUG
+
+/// Lists the blocks in use.
+static void tlsf_report_leaks(tlsf_t* t, const char* func)
+{
+  leak_report_t report = { func, 0, 0 };
+
+  for (tlsf_block_t* b = (tlsf_block_t*)t->buf; b && tlsf_size(b); b = tlsf_next_phys(b)) {
+    if (!tlsf_is_free(b)) {
+      unsigned char* ptr = (unsigned char*)b + TLSF_HDR_SIZE;
+      leak_report_add(&report, ptr, mem_canary_check(ptr, tlsf_size(b), func));
+    }
+  }
+
+  leak_report_end(&report);
+}
+
+#endif
+
+void tlsf_free_all(tlsf_t* t)
+{
+  VALIDATE_PTR(t);
+
+#ifdef BASE_DEBUG
+  tlsf_report_leaks(t, "tlsf_free_all");
+#endif
+  STATS_USAGE(&t->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_TLSF, t, NULL, NULL, 0, 0);
+
+  tlsf_reset(t);
+}
+
+void* tlsf_alloc_align(tlsf_t* t, size_t size, uintptr_t align)
+{
+  void* ptr = tlsf_alloc_nozero_align(t, size, align);
+  return ptr ? memset(ptr, 0, size) : NULL;
+}
+
+void* tlsf_alloc_nozero_align(tlsf_t* t, size_t size, uintptr_t align)
+{
+  VALIDATE_PTR(t, NULL);
+
+  size_t block_size = size + MEM_TRAILER_SIZE;
+  size_t aligned_size = (size_t)align_size(block_size < TLSF_MIN_SIZE ? TLSF_MIN_SIZE : block_size, TLSF_ALIGN);
+  size_t gap_min = TLSF_HDR_SIZE + TLSF_MIN_SIZE;
+  bool over_aligned = align > TLSF_ALIGN;
+
+  tlsf_block_t* b = tlsf_locate(t, over_aligned ? aligned_size + align + gap_min : aligned_size);
+
+  if (!b)
+    STATS_FAIL(&t->stats);
+
+  CHECK_PTR(b, NULL);
+  MEM_ASAN_UNPOISON((unsigned char*)b + TLSF_HDR_SIZE, tlsf_size(b));
+
+  if (over_aligned) {
+    uintptr_t payload = (uintptr_t)b + TLSF_HDR_SIZE;
+    uintptr_t aligned = align_ptr(payload, align);
+
+    // A gap in front of the aligned address becomes a free block of its own.
+    if (aligned != payload && aligned - payload < gap_min)
+      aligned = align_ptr(payload + gap_min, align);
+
+    if (aligned != payload) {
+      size_t gap = (size_t)(aligned - payload);
+      tlsf_block_t* aligned_block = tlsf_from_ptr((void*)aligned);
+      aligned_block->size = tlsf_size(b) - gap;
+      aligned_block->prev_phys = b;
+      tlsf_next_phys(aligned_block)->prev_phys = aligned_block;
+
+      b->size = (gap - TLSF_HDR_SIZE) | TLSF_FREE_BIT;
+      tlsf_insert(t, b);
+      b = aligned_block;
+    }
+  }
+
+  tlsf_trim(t, b, aligned_size);
+  b->size &= ~TLSF_FREE_BIT;
+  STATS_ALLOC(&t->stats, tlsf_size(b));
+  TRACE(TRACE_ALLOC, TRACE_TLSF, t, (unsigned char*)b + TLSF_HDR_SIZE, NULL, size, align);
+  mem_canary_set((unsigned char*)b + TLSF_HDR_SIZE, size, tlsf_size(b));
+
+  return mem_poison((unsigned char*)b + TLSF_HDR_SIZE, size);
+}
+
+void tlsf_free(tlsf_t* t, void* ptr)
+{
+  VALIDATE_PTR(t);
+  CHECK_PTR(ptr);
+
+  if (!within_bounds(ptr, t->buf, t->size)) {
+    flog(LOG_WARNING, "tlsf_free(): the block to be freed is not in the given buffer");
+    return;
+  }
+
+  tlsf_block_t* b = tlsf_from_ptr(ptr);
+
+  if (tlsf_is_free(b)) {
+    flog(LOG_WARNING, "tlsf_free(): block %p freed twice", ptr);
+    return;
+  }
+
+  mem_canary_check(ptr, tlsf_size(b), "tlsf_free");
+  MEM_ASAN_UNPOISON(ptr, TLSF_MIN_SIZE);
+  b->size |= TLSF_FREE_BIT;
+  STATS_FREE(&t->stats, tlsf_size(b));
+  TRACE(TRACE_FREE, TRACE_TLSF, t, ptr, NULL, 0, 0);
+
+  tlsf_block_t* prev = b->prev_phys;
+
+  if (prev && tlsf_is_free(prev)) {
+    tlsf_remove(t, prev);
+    prev->size += TLSF_HDR_SIZE + tlsf_size(b);
+    b = prev;
+    tlsf_next_phys(b)->prev_phys = b;
+  }
+
+  tlsf_block_t* next = tlsf_next_phys(b);
+
+  if (tlsf_is_free(next)) {
+    tlsf_remove(t, next);
+    b->size += TLSF_HDR_SIZE + tlsf_size(next);
+    tlsf_next_phys(b)->prev_phys = b;
+  }
+
+  tlsf_insert(t, b);
+}
+
+size_t tlsf_block_size(void* ptr)
+{
+  VALIDATE_PTR(ptr, 0);
+
+#ifdef BASE_DEBUG
+  return mem_canary_check(ptr, tlsf_size(tlsf_from_ptr(ptr)), "tlsf_block_size");
+#else
+  return tlsf_size(tlsf_from_ptr(ptr));
+#endif
+}
+
+alloc_stats_t tlsf_stats(tlsf_t* t)
+{
+  alloc_stats_t stats = { 0 };
+
+  VALIDATE_PTR(t, stats);
+
+#ifdef BASE_STATS
+  stats = t->stats;
+#endif
+  stats.capacity = t->size;
+
+  // The walk ends at the sentinel, the only empty block in use.
+  for (tlsf_block_t* b = (tlsf_block_t*)t->buf; b && tlsf_size(b); b = tlsf_next_phys(b)) {
+    if (tlsf_is_free(b))
+      alloc_stats_free_block(&stats, tlsf_size(b));
+  }
+
+  return stats;
+}
+
+static void* arena_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  return arena_alloc_nozero_align((arena_t*)ctx, size, align);
+}
+
+static void arena_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  arena_t* a = (arena_t*)ctx;
+
+  if (ptr == a->buf + a->prev_offset)
+    arena_pop(a);
+}
+
+static void* arena_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  return arena_resize_impl((arena_t*)ctx, ptr, old_size, new_size, align, false);
+}
+
+allocator_t arena_allocator(arena_t* a)
+{
+  allocator_t allocator = { arena_allocator_alloc, arena_allocator_resize, arena_allocator_free, a };
+  return allocator;
+}
+
+static void* stack_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  return stack_alloc_nozero_align((stack_t*)ctx, size, align);
+}
+
+static void stack_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  stack_t* s = (stack_t*)ctx;
+
+  if (s->curr_hdr && ptr == (unsigned char*)s->curr_hdr + sizeof(hdr_t))
+    stack_pop(s);
+}
+
+static void* stack_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  return stack_resize_impl((stack_t*)ctx, ptr, old_size, new_size, align, false);
+}
+
+allocator_t stack_allocator(stack_t* s)
+{
+  allocator_t allocator = { stack_allocator_alloc, stack_allocator_resize, stack_allocator_free, s };
+  return allocator;
+}
+
+static void* pool_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  pool_t* p = (pool_t*)ctx;
+
+  if (size > p->slot_size || align > p->align) {
+    STATS_FAIL(&p->stats);
+    flog(LOG_WARNING, "pool_allocator: %zu bytes don't fit into a slot", size);
+    return NULL;
+  }
+
+  return pool_alloc_nozero(p);
+}
+
+static void* pool_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  if (ptr && new_size <= ((pool_t*)ctx)->slot_size) {
+    TRACE(TRACE_RESIZE, TRACE_POOL, ctx, ptr, ptr, new_size, align);
+    return ptr;
+  }
+
+  return ptr ? NULL : pool_allocator_alloc(ctx, new_size, align);
+}
+
+static void pool_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  pool_free((pool_t*)ctx, ptr);
+}
+
+allocator_t pool_allocator(pool_t* p)
+{
+  allocator_t allocator = { pool_allocator_alloc, pool_allocator_resize, pool_allocator_free, p };
+  return allocator;
+}
+
+static void* cpool_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  cpool_t* p = (cpool_t*)ctx;
+
+  if (size > p->slot_size || ((uintptr_t)p->buf | p->slot_size) & (align - 1)) {
+    flog(LOG_WARNING, "cpool_allocator: %zu bytes don't fit into a slot", size);
+    return NULL;
+  }
+
+  return cpool_alloc_nozero(p);
+}
+
+static void* cpool_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  if (ptr && new_size <= ((cpool_t*)ctx)->slot_size) {
+    TRACE(TRACE_RESIZE, TRACE_CPOOL, ctx, ptr, ptr, new_size, align);
+    return ptr;
+  }
+
+  return ptr ? NULL : cpool_allocator_alloc(ctx, new_size, align);
+}
+
+static void cpool_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  cpool_free((cpool_t*)ctx, ptr);
+}
+
+allocator_t cpool_allocator(cpool_t* p)
+{
+  allocator_t allocator = { cpool_allocator_alloc, cpool_allocator_resize, cpool_allocator_free, p };
+  return allocator;
+}
+
+static void* free_list_first_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  // `free()` has no alignment to find the header of an over-aligned block with.
+  if (align > DEFAULT_ALIGN) {
+    flog(LOG_ERROR, "free_list_allocator: alignment larger than DEFAULT_ALIGN not supported");
+    return NULL;
+  }
+
+  return free_list_alloc_nozero_align((free_list_t*)ctx, size, FIRST_SLOT, align);
+}
+
+static void* free_list_best_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  // `free()` has no alignment to find the header of an over-aligned block with.
+  if (align > DEFAULT_ALIGN) {
+    flog(LOG_ERROR, "free_list_allocator: alignment larger than DEFAULT_ALIGN not supported");
+    return NULL;
+  }
+
+  return free_list_alloc_nozero_align((free_list_t*)ctx, size, BEST_SLOT, align);
+}
+
+static void free_list_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  free_list_free((free_list_t*)ctx, ptr);
+}
+
+static void* free_list_first_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  return allocator_move(free_list_first_alloc, free_list_allocator_free, ctx, ptr, old_size, new_size, align);
+}
+
+static void* free_list_best_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  return allocator_move(free_list_best_alloc, free_list_allocator_free, ctx, ptr, old_size, new_size, align);
+}
+
+allocator_t free_list_allocator(free_list_t* fl, fl_policy policy)
+{
+  allocator_t allocator = { free_list_first_alloc, free_list_first_resize, free_list_allocator_free, fl };
+
+  if (policy == BEST_SLOT) {
+    allocator.alloc = free_list_best_alloc;
+    allocator.resize = free_list_best_resize;
+  }
+
+  return allocator;
+}
+
+static void* tlsf_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  return tlsf_alloc_nozero_align((tlsf_t*)ctx, size, align);
+}
+
+static void tlsf_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  tlsf_free((tlsf_t*)ctx, ptr);
+}
+
+static void* tlsf_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  size_t block_size = ptr ? tlsf_size(tlsf_from_ptr(ptr)) : 0;
+
+  if (ptr && new_size + MEM_TRAILER_SIZE <= block_size) {
+    mem_canary_check(ptr, block_size, "tlsf_allocator_resize");
+    mem_canary_set(ptr, new_size, block_size);
+    TRACE(TRACE_RESIZE, TRACE_TLSF, ctx, ptr, ptr, new_size, align);
+    return ptr;
+  }
+
+  return allocator_move(tlsf_allocator_alloc, tlsf_allocator_free, ctx, ptr, old_size, new_size, align);
+}
+
+allocator_t tlsf_allocator(tlsf_t* t)
+{
+  allocator_t allocator = { tlsf_allocator_alloc, tlsf_allocator_resize, tlsf_allocator_free, t };
+  return allocator;
+}
@@ -6,6 +6,7 @@
 
 #include <memory.h>
 #include <stdalign.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -14,13 +15,154 @@
 
 #include "base/mem_utils.h"
 #include "base/log.h"
+#include "base/trace.h"
+
+/* 
+  --- ALLOCATOR INTERFACE ---
+
+  Common interface to all allocators below, so that containers don't need
+  to know where their memory comes from. Each allocator provides a function
+  that wraps it into an `allocator_t`, e.g. `arena_allocator()`. Memory
+  handed out through the interface is not zeroed. `resize` may move the
+  block; it copies the contents up to the smaller of both sizes and
+  returns null on failure, leaving the old block untouched. `free` is a
+  no-op for allocators that can't free single blocks.
+
+*/
+
+typedef struct allocator {
+  void* (*alloc)(void* ctx, size_t size, uintptr_t align);
+  void* (*resize)(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align);
+  void  (*free)(void* ctx, void* ptr, size_t size);
+  void* ctx;
+} allocator_t;
+
+/// @brief Allocates `size` bytes through the given allocator.
+static inline void* allocator_alloc(const allocator_t* a, size_t size, uintptr_t align)
+{
+  return a->alloc(a->ctx, size, align);
+}
+
+/// @brief Resizes a block allocated through the given allocator. If `ptr` is null,
+/// a new block is allocated.
+static inline void* allocator_resize(const allocator_t* a, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  return a->resize(a->ctx, ptr, old_size, new_size, align);
+}
+
+/// @brief Frees a block allocated through the given allocator.
+static inline void allocator_free(const allocator_t* a, void* ptr, size_t size)
+{
+  a->free(a->ctx, ptr, size);
+}
+
+/// @brief Returns an allocator using `malloc()`, `realloc()` and `free()`.
+/// It supports alignments up to `DEFAULT_ALIGN`.
+allocator_t heap_allocator(void);
+
+/* 
+  --- STATISTICS ---
+
+  With `BASE_STATS` defined, the arena, stack, pool, free list and TLSF
+  allocators count allocations, frees and failed requests, and track the
+  bytes in use along with their peak. Without it, these counters read 0 and
+  the allocators carry no code to update them. The fields are there either
+  way, so the layout of the allocators doesn't depend on the define.
+  Capacity and the layout of free blocks are taken from the allocator's
+  state when `*_stats()` is called, so they are reported either way.
+  Bytes in use include alignment padding and, for the linear allocators,
+  headers and gaps; a chained arena counts its older blocks as full.
+
+*/
+
+typedef struct alloc_stats {
+  size_t allocs;              // Successful allocations.
+  size_t frees;               // Blocks freed one by one.
+  size_t failed;              // Allocations that couldn't be served.
+  size_t in_use;              // Bytes handed out.
+  size_t peak;                // Highest value of `in_use` so far.
+  size_t capacity;            // Bytes the allocator currently manages.
+  size_t free_bytes;          // Free list and TLSF: bytes in free blocks.
+  size_t free_blocks;         // Free list and TLSF: number of free blocks.
+  size_t largest_free;        // Free list and TLSF: size of the largest free block.
+  double fragmentation;       // Free list and TLSF: 1 - largest_free / free_bytes.
+} alloc_stats_t;
+
+#ifdef BASE_STATS
+  #define STATS_ALLOC(stats, bytes) alloc_stats_alloc(stats, bytes)
+  #define STATS_FREE(stats, bytes) alloc_stats_free(stats, bytes)
+  #define STATS_FAIL(stats) (++(stats)->failed)
+  #define STATS_USAGE(stats, bytes) alloc_stats_usage(stats, bytes)
+  #define STATS_INIT(stats) (*(stats) = (alloc_stats_t){ 0 })
+#else
+  #define STATS_ALLOC(stats, bytes) ((void)0)
+  #define STATS_FREE(stats, bytes) ((void)0)
+  #define STATS_FAIL(stats) ((void)0)
+  #define STATS_USAGE(stats, bytes) ((void)0)
+  #define STATS_INIT(stats) ((void)0)
+#endif
+
+/// @brief ---INTERNAL FUNCTION---
+/// Sets the bytes in use and raises the peak if needed.
+static inline void alloc_stats_usage(alloc_stats_t* stats, size_t bytes)
+{
+  stats->in_use = bytes;
+
+  if (bytes > stats->peak)
+    stats->peak = bytes;
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Counts an allocation of `bytes` bytes.
+static inline void alloc_stats_alloc(alloc_stats_t* stats, size_t bytes)
+{
+  ++stats->allocs;
+  alloc_stats_usage(stats, stats->in_use + bytes);
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Counts the freeing of `bytes` bytes.
+static inline void alloc_stats_free(alloc_stats_t* stats, size_t bytes)
+{
+  ++stats->frees;
+  stats->in_use -= bytes;
+}
+
+/// @brief Writes the given statistics to the log, labeled with `name`.
+void alloc_stats_log(const char* name, const alloc_stats_t* stats);
+
+/* 
+  --- DEBUG MODE ---
+
+  With `BASE_DEBUG` defined, the allocators check how they are used:
+  Blocks of the arena, stack, free list and TLSF allocators are followed
+  by a red zone of canary bytes (see `mem_canary_set()`), which is checked
+  when the block is freed or resized, and, for the linear allocators, when
+  the last block is popped or the allocator is cleared. An overwritten
+  canary terminates the program. Stack pops and free list frees check the
+  block headers, pools detect slots that are freed twice, and the pool,
+  free list and TLSF allocators list the blocks still in use when they
+  free everything at once. Built with `-fsanitize=address` as well, free
+  memory is poisoned, so AddressSanitizer reports any access to it.
+  Independently, `BASE_GUARD_PAGES` puts the blocks of chained arenas
+  between inaccessible pages; `vmem_alloc_guarded()` does the same for
+  the buffer of any other allocator. Without either, none of the checks
+  are compiled in.
+
+*/
+
+// Blocks listed one by one when an allocator frees blocks that are still in use.
+#ifndef LEAK_REPORT_MAX
+  #define LEAK_REPORT_MAX 8
+#endif
 
 /* 
   --- DYNAMIC ARRAY --- 
   
   Simple dynamic array, similar to std::vector. It unfortunately
   only checks for the size of a pushed element.
-  Grows geometrically.
+  Grows geometrically. Its memory comes from the heap, unless another
+  allocator is given to `darray_init_alloc()`.
 
 */
 
@@ -28,6 +170,7 @@ typedef struct da_hdr {
   size_t capacity;
   size_t occupied;
   size_t element_size;
+  allocator_t allocator;
 } da_hdr_t;
 
 /// @brief ---INTERNAL FUNCTION---
@@ -41,6 +184,13 @@ static inline da_hdr_t* darray_get_hdr(void* darray)
 /// @brief Initializes a dynamic array with the given size.
 void* darray_init(size_t element_size, size_t num);
 
+/// @brief Initializes a dynamic array with the given size, whose memory
+/// comes from the given allocator.
+void* darray_init_alloc(size_t element_size, size_t num, allocator_t allocator);
+
+/// @brief Frees the array through the allocator it was created with.
+void darray_free(void* darray);
+
 /// @brief ---INTERNAL FUNCTION---
 /// Checks if the dynamic array has enough capacity to 
 /// accommdate the given number additional elements. 
@@ -73,14 +223,58 @@ do {\
   (darray)[pos] = (element);\
 } while (0);
 
+/// @brief Appends `num` elements, read from `elements`, to the given array,
+/// with a single capacity check and copy. `elements` must not point into the
+/// array itself, since it may be re-allocated.
+#define darray_push_n(darray, elements, num)\
+do {\
+  if (sizeof(*(darray)) != sizeof(*(elements))) {\
+    flog(LOG_ERROR, "darray_push_n: elements to push have not the right type");\
+    exit(EXIT_FAILURE);\
+  }\
+  \
+  (darray) = darray_push_n_base(darray, elements, sizeof(*(elements)), num);\
+} while (0);
+
+/// @brief Inserts `num` elements, read from `elements`, at the given position,
+/// with a single capacity check and move. `elements` must not point into the
+/// array itself.
+#define darray_insert_n(darray, pos, elements, num)\
+do {\
+  if (sizeof(*(darray)) != sizeof(*(elements))) {\
+    flog(LOG_ERROR, "darray_insert_n: elements to insert have not the right type");\
+    exit(EXIT_FAILURE);\
+  }\
+  \
+  (darray) = darray_insert_n_base(darray, pos, elements, sizeof(*(elements)), num);\
+} while (0);
+
+/// @brief Appends all elements of the array `src` to the array `dst`.
+/// `src` and `dst` must be different arrays.
+#define darray_append_darray(dst, src)\
+do {\
+  if ((src) && darray_size(src) > 0)\
+    darray_push_n(dst, src, darray_size(src));\
+} while (0);
+
+/// @brief Base function of the `darray_push_n` macro.
+void* darray_push_n_base(void* darray, const void* elements, size_t element_size, size_t num);
+
+/// @brief Base function of the `darray_insert_n` macro.
+void* darray_insert_n_base(void* darray, size_t pos, const void* elements, size_t element_size, size_t num);
+
 /// @brief Creates a given number of vacant slots at the given position. 
 void* darray_make_space(void* darray, size_t pos, size_t element_size, size_t num);
 
+/// @brief Removes `num` elements starting at position `first`. The elements
+/// behind them move to the left with a single move. Capacity remains unchanged.
+void darray_erase_range(void* darray, size_t first, size_t num);
+
 /// @brief Removes the last element. Capacity remains unchanged.
 void darray_pop_last(void* darray);
 
 /// @brief Removes the first element. 
-/// The others each move one position to the left.
+/// The others each move one position to the left. For FIFO use, take a deque.
 void darray_pop_first(void* darray);
 
 /// @brief Removes all elements. Capacity remains unchanged.
@@ -122,6 +316,147 @@ do {\
 /// @brief Base function of the `darray_shrink_to_fit` macro.
 void darray_shrink_to_fit_base(void** darray);
 
+/* 
+  --- DEQUE ---
+
+  Double-ended queue on a ring buffer, with the same header-before-data
+  layout as the dynamic array. Pushing and popping at both ends takes
+  constant time. The capacity is always a power of 2, so a logical index
+  maps to a slot of the buffer with a mask; use `deque_at()` and friends
+  to index the buffer, e.g. `deque[deque_at(deque, i)]`. The elements
+  occupy at most two contiguous spans, see `deque_spans()`.
+
+*/
+
+typedef struct dq_hdr {
+  size_t capacity;
+  size_t head;
+  size_t occupied;
+  size_t element_size;
+  allocator_t allocator;
+} dq_hdr_t;
+
+typedef struct deque_span {
+  void* data;
+  size_t len;
+} deque_span_t;
+
+/// @brief ---INTERNAL FUNCTION---
+/// Returns the header of the deque, containing relevant meta data.
+static inline dq_hdr_t* deque_get_hdr(void* deque)
+{
+  uintptr_t hdr_size = align_size(sizeof(dq_hdr_t), DEFAULT_ALIGN);
+  return deque ? (dq_hdr_t*)((uintptr_t)deque - hdr_size) : NULL;
+}
+
+/// @brief Initializes a deque with room for at least `num` elements.
+void* deque_init(size_t element_size, size_t num);
+
+/// @brief Initializes a deque with room for at least `num` elements, whose
+/// memory comes from the given allocator.
+void* deque_init_alloc(size_t element_size, size_t num, allocator_t allocator);
+
+/// @brief Frees the deque through the allocator it was created with.
+void deque_free(void* deque);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Makes room for `num` additional elements, doubling the capacity as
+/// often as needed. Creates the deque if it's null.
+void* deque_grow(void* deque, size_t element_size, size_t num);
+
+/// @brief Returns the number of elements in the deque.
+static inline size_t deque_size(void* deque)
+{
+  return deque ? deque_get_hdr(deque)->occupied : 0;
+}
+
+/// @brief Returns the capacity of the deque.
+static inline size_t deque_capacity(void* deque)
+{
+  return deque ? deque_get_hdr(deque)->capacity : 0;
+}
+
+/// @brief Returns the buffer index of the element at logical position `i`.
+static inline size_t deque_at(void* deque, size_t i)
+{
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  return (hdr->head + i) & (hdr->capacity - 1);
+}
+
+/// @brief Returns the buffer index of the first element.
+static inline size_t deque_front(void* deque)
+{
+  return deque_get_hdr(deque)->head;
+}
+
+/// @brief Returns the buffer index of the last element.
+static inline size_t deque_back(void* deque)
+{
+  return deque_at(deque, deque_get_hdr(deque)->occupied - 1);
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Claims the slot behind the last element, which must exist.
+/// @return Its buffer index.
+static inline size_t deque_claim_back(void* deque)
+{
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  return (hdr->head + hdr->occupied++) & (hdr->capacity - 1);
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Claims the slot in front of the first element, which must exist.
+/// @return Its buffer index.
+static inline size_t deque_claim_front(void* deque)
+{
+  dq_hdr_t* hdr = deque_get_hdr(deque);
+  hdr->head = (hdr->head - 1) & (hdr->capacity - 1);
+  ++hdr->occupied;
+  return hdr->head;
+}
+
+/// @brief Appends an element to the given deque.
+#define deque_push_back(deque, element)\
+do {\
+  if (sizeof(*(deque)) != sizeof(element)) {\
+    flog(LOG_ERROR, "deque_push_back: element to push has not the right type");\
+    exit(EXIT_FAILURE);\
+  }\
+  \
+  (deque) = deque_grow(deque, sizeof(element), 1);\
+  (deque)[deque_claim_back(deque)] = (element);\
+} while (0);
+
+/// @brief Prepends an element to the given deque.
+#define deque_push_front(deque, element)\
+do {\
+  if (sizeof(*(deque)) != sizeof(element)) {\
+    flog(LOG_ERROR, "deque_push_front: element to push has not the right type");\
+    exit(EXIT_FAILURE);\
+  }\
+  \
+  (deque) = deque_grow(deque, sizeof(element), 1);\
+  (deque)[deque_claim_front(deque)] = (element);\
+} while (0);
+
+/// @brief Removes the first element. Read it with `deque[deque_front(deque)]` before.
+void deque_pop_front(void* deque);
+
+/// @brief Removes the last element. Read it with `deque[deque_back(deque)]` before.
+void deque_pop_back(void* deque);
+
+/// @brief Removes the first `num` elements at once, e.g. after processing
+/// them through `deque_spans()`.
+void deque_pop_front_n(void* deque, size_t num);
+
+/// @brief Removes all elements. Capacity remains unchanged.
+void deque_clear(void* deque);
+
+/// @brief Fills `spans` with the contiguous parts of the deque, in order.
+/// The second span is empty unless the elements wrap around the end of the buffer.
+/// @return The number of non-empty spans.
+size_t deque_spans(void* deque, deque_span_t spans[2]);
+
 /* 
   --- ARENA ALLOCATOR ---
 
@@ -129,21 +464,81 @@ void darray_shrink_to_fit_base(void** darray);
   to dynamic array, the arena accommodates data of mixed types.
   Only allows to pop the last element *once*, otherwise all elements have
   to be freed at once (similar to a stack frame).
-  As of yet, the arena's buffer can't be re-allocated either.
+  An arena initialized with `arena_init()` works on a fixed buffer and
+  terminates the program when it runs out of space. The other two modes
+  grow instead, without ever moving existing allocations:
+  `ARENA_CHAINED` links new heap blocks as the current one fills up,
+  `ARENA_VIRTUAL` reserves a large range of address space up front and
+  commits pages as the offset moves forward.
 
 */
 
+#ifndef ARENA_COMMIT_SIZE
+  #define ARENA_COMMIT_SIZE (64 * 1024)
+#endif
+
+typedef enum {
+  ARENA_FIXED,
+  ARENA_CHAINED,
+  ARENA_VIRTUAL,
+  ARENA_NUM_MODES
+} arena_mode;
+
+typedef struct arena_block {
+  struct arena_block* prev;
+  size_t size;
+} arena_block_t;
+
 typedef struct arena {
   unsigned char* buf;
   size_t size;
   size_t curr_offset;
   size_t prev_offset;
+  size_t committed;
+  arena_mode mode;
+  arena_block_t* block;
+  size_t block_size;
+  size_t high_water;
+  size_t temp_depth;
+  alloc_stats_t stats;
+  size_t stats_base;              // Bytes in the blocks behind the current one.
 } arena_t;
 
+/// @brief Savepoint of an arena, see `arena_temp_begin()`.
+typedef struct arena_temp {
+  arena_t* arena;
+  arena_block_t* block;
+  size_t curr_offset;
+  size_t prev_offset;
+  size_t depth;
+} arena_temp_t;
+
 /// @brief Initializes the arena. The buffer might live on either
 /// stack or heap and is therefore needed to be given manually.
 void arena_init(arena_t* a, void* buf, size_t size);
 
+/// @brief Initializes an arena that allocates its memory from the heap, in blocks
+/// of at least `block_size` bytes. When a block is full, a new one is linked
+/// in front of it. Call `arena_release()` to free the blocks.
+void arena_init_chained(arena_t* a, size_t block_size);
+
+/// @brief Initializes an arena that reserves `reserve_size` bytes of address space
+/// and commits them in steps of `ARENA_COMMIT_SIZE` as needed. `arena_clear()` keeps
+/// up to `high_water` bytes committed and gives the rest back to the OS (pass `SIZE_MAX`
+/// to keep everything). Call `arena_release()` to unmap the range.
+void arena_init_virtual(arena_t* a, size_t reserve_size, size_t high_water);
+
+/// @brief Frees the memory of a chained or virtual arena. For an arena
+/// with a user-supplied buffer, this only resets the arena.
+void arena_release(arena_t* a);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Makes room for an allocation ending at `end` bytes from the buffer start,
+/// by committing more memory or starting a new block. In the latter case,
+/// the offsets are reset, so they have to be recalculated.
+/// @return False if the arena can't grow any further.
+bool arena_grow(arena_t* a, size_t end, size_t size, uintptr_t align);
+
 /// @brief Allocates the specified number of bytes in the arena, 
 /// with manual alignment (probably rarely of use). For default
 /// alignment, use `arena_alloc` instead.
@@ -160,35 +555,39 @@ static inline void* arena_alloc(arena_t* a, size_t size)
   return arena_alloc_align(a, size, DEFAULT_ALIGN);
 }
 
+/// @brief Same as `arena_alloc_align()`, but leaves the memory uninitialized.
+void* arena_alloc_nozero_align(arena_t* a, size_t size, uintptr_t align);
+
+/// @brief Same as `arena_alloc()`, but leaves the memory uninitialized.
+static inline void* arena_alloc_nozero(arena_t* a, size_t size)
+{
+  return arena_alloc_nozero_align(a, size, DEFAULT_ALIGN);
+}
+
 /// @brief Resizes the block of memory that the `element` pointer has access to,
 /// with manual alignment. For default alignment, use `arena_resize_element()` instead.
-/// If the new size is larger than the old size and it is not the last element, the
-/// element will be moved to the end of the occupied block, leaving a gap that won't
-/// reused until the arena is freed. If `element` is null, a new block of size `new_size`
-/// will be allocated, with `element` then pointing to it.
-void arena_resize_element_align(arena_t* a, void* element, size_t old_size, size_t new_size, uintptr_t align);
+/// The last element is extended or shrunk in place, without copying, as long as
+/// the arena has room. Any other element is only moved if it grows, to the end of
+/// the occupied block, leaving a gap that won't be reused until the arena is cleared.
+/// If `element` is null, a new block of size `new_size` is allocated.
+/// @return The (possibly moved) element.
+void* arena_resize_element_align(arena_t* a, void* element, size_t old_size, size_t new_size, uintptr_t align);
 
 /// @brief Resizes the block of memory that the `element` pointer has access to,
 /// with default alignment. For manual alignment, use `arena_resize_element_align()` instead.
-/// If the new size is larger than the old size and it is not the last element, the
-/// element will be moved to the end of the occupied block, leaving a gap that won't
-/// reused until the arena is freed. If `element` is null, a new block of size `new_size`
-/// will be allocated, with `element` then pointing to it.
-static inline void  arena_resize_element(arena_t* a, void* element, size_t old_size, size_t new_size)
+/// Works as `arena_resize_element_align()` otherwise.
+/// @return The (possibly moved) element.
+static inline void* arena_resize_element(arena_t* a, void* element, size_t old_size, size_t new_size)
 {
-  arena_resize_element_align(a, element, old_size, new_size, DEFAULT_ALIGN);  
+  return arena_resize_element_align(a, element, old_size, new_size, DEFAULT_ALIGN);
 }
 
 /// @brief Sets all bytes in the arena to 0.
-static inline void arena_zero(arena_t* a)
-{
-  if (!a) {
-    flog(LOG_WARNING, "arena_zero(): arena invalid");
-    return;
-  }
+void arena_zero(arena_t* a);
 
-  memset(a->buf, 0, a->size);
-}
+/// @brief ---INTERNAL FUNCTION---
+/// Checks the canary of the last element in `BASE_DEBUG` builds, if there is one.
+void arena_check_last(arena_t* a, const char* func);
 
 /// @brief Removes the last element. This works only once before
 /// a new element needs to be added. For more granular control,
@@ -200,23 +599,97 @@ static inline void arena_pop(arena_t* a)
     return;
   }
 
+#ifdef BASE_DEBUG
+  arena_check_last(a, "arena_pop");
+#endif
+  TRACE(TRACE_FREE, TRACE_ARENA, a, a->buf + a->prev_offset, NULL, 0, 0);
+  MEM_ASAN_POISON(a->buf + a->prev_offset, a->curr_offset - a->prev_offset);
   a->curr_offset = a->prev_offset;
+  STATS_FREE(&a->stats, 0);
+  STATS_USAGE(&a->stats, a->stats_base + a->curr_offset);
 }
 
-/// @brief Sets the internal offset to 0, allowing the buffer to
-/// be overwritten in its entirety. This doesn't free the buffer
-/// itself, however! 
-static inline void arena_clear(arena_t* a)
+/// @brief Opens a temporary scope: everything allocated in the arena until
+/// the matching `arena_temp_end()` is freed at once, in O(1). Scopes can be
+/// nested, but have to be ended in reverse order. Clearing the arena inside
+/// a scope invalidates it.
+/// @return The savepoint to hand to `arena_temp_end()`.
+static inline arena_temp_t arena_temp_begin(arena_t* a)
 {
+  arena_temp_t temp = { a, NULL, 0, 0, 0 };
+
   if (!a) {
-    flog(LOG_WARNING, "arena_clear(): arena invalid");
-    return;
+    flog(LOG_WARNING, "arena_temp_begin(): arena invalid");
+    return temp;
   }
 
-  a->curr_offset = 0;
-  a->prev_offset = 0;
+  temp.block = a->block;
+  temp.curr_offset = a->curr_offset;
+  temp.prev_offset = a->prev_offset;
+  temp.depth = ++a->temp_depth;
+
+  return temp;
 }
 
+/// @brief Rolls the arena back to the state of the given savepoint. In a chained
+/// arena, blocks added since `arena_temp_begin()` are freed.
+void arena_temp_end(arena_temp_t temp);
+
+/// @brief Sets the internal offset to 0, allowing the buffer to
+/// be overwritten in its entirety. This doesn't free a user-supplied
+/// buffer, however! A chained arena frees all blocks but the first one,
+/// a virtual arena decommits everything above its high-water mark.
+void arena_clear(arena_t* a);
+
+/// @brief Returns the statistics of the arena, see `alloc_stats_t`.
+alloc_stats_t arena_stats(arena_t* a);
+
+/// @brief Wraps the arena into an `allocator_t`. Freeing only
+/// works for the last allocation, as with `arena_pop()`. Resizing the
+/// last allocation happens in place, so a dynamic array at the end of
+/// the arena grows without copying.
+allocator_t arena_allocator(arena_t* a);
+
+/* 
+  --- SCRATCH ARENAS ---
+
+  Every thread owns `SCRATCH_COUNT` virtual arenas for temporary memory,
+  created on first use. A function that receives an arena to allocate its
+  results in passes that arena as a conflict, so its own temporaries never
+  end up in (and get rolled back with) the caller's memory. No locks and no
+  heap allocations are involved after the first call.
+
+*/
+
+#ifndef SCRATCH_COUNT
+  #define SCRATCH_COUNT 2
+#endif
+
+#ifndef SCRATCH_RESERVE_SIZE
+  #define SCRATCH_RESERVE_SIZE ((size_t)64 * 1024 * 1024)
+#endif
+
+#ifndef SCRATCH_HIGH_WATER
+  #define SCRATCH_HIGH_WATER ((size_t)1024 * 1024)
+#endif
+
+/// @brief Opens a temporary scope in one of the calling thread's scratch arenas,
+/// choosing one that isn't among the given `conflicts` (which may be null if
+/// `num_conflicts` is 0). Terminates the program if all of them conflict.
+/// @return The savepoint to hand to `scratch_end()`; its `arena` member is the
+/// arena to allocate from.
+arena_temp_t scratch_begin(arena_t** conflicts, size_t num_conflicts);
+
+/// @brief Rolls the scratch arena back to the state at `scratch_begin()`.
+static inline void scratch_end(arena_temp_t scratch)
+{
+  arena_temp_end(scratch);
+}
+
+/// @brief Frees the calling thread's scratch arenas. Should be called before
+/// a thread that used them exits; they are recreated on the next `scratch_begin()`.
+void scratch_release(void);
+
 /* 
   --- STACK ALLOCATOR ---
 
@@ -236,6 +709,7 @@ typedef struct stack {
   hdr_t* curr_hdr;
   size_t size;
   size_t curr_offset;
+  alloc_stats_t stats;
 } stack_t;
 
 /// @brief ---INTERNAL FUNCTION--- Adjust the current offset to accommodate a header
@@ -261,25 +735,38 @@ static inline void* stack_alloc(stack_t* s, size_t size)
   return stack_alloc_align(s, size, DEFAULT_ALIGN);
 }
 
+/// @brief Same as `stack_alloc_align()`, but leaves the memory uninitialized.
+void* stack_alloc_nozero_align(stack_t* s, size_t size, uintptr_t align);
+
+/// @brief Same as `stack_alloc()`, but leaves the memory uninitialized.
+static inline void* stack_alloc_nozero(stack_t* s, size_t size)
+{
+  return stack_alloc_nozero_align(s, size, DEFAULT_ALIGN);
+}
+
 /// @brief Resizes the block of memory that the `element` pointer has access to,
 /// with manual alignment. For default alignment, use `stack_resize_element()` instead.
-/// If the new size is larger than the old size and it is not the last element, the
-/// element will be moved to the end of the occupied block, leaving a gap that won't
-/// reused until the arena is freed. If `element` is null, a new block of size `new_size`
-/// will be allocated, with `element` then pointing to it.
-void stack_resize_element_align(stack_t* s, void* element, size_t old_size, size_t new_size, uintptr_t align);
+/// The last element is extended or shrunk in place, without copying, as long as
+/// the stack has room. Any other element is only moved if it grows, to the end of
+/// the occupied block, leaving a gap that won't be reused until the stack is cleared.
+/// If `element` is null, a new block of size `new_size` is allocated.
+/// @return The (possibly moved) element.
+void* stack_resize_element_align(stack_t* s, void* element, size_t old_size, size_t new_size, uintptr_t align);
 
 /// @brief Resizes the block of memory that the `element` pointer has access to,
 /// with default alignment. For manual alignment, use `stack_resize_element_align()` instead.
-/// If the new size is larger than the old size and it is not the last element, the
-/// element will be moved to the end of the occupied block, leaving a gap that won't
-/// reused until the arena is freed. If `element` is null, a new block of size `new_size`
-/// will be allocated, with `element` then pointing to it.
-static inline void stack_resize_element(stack_t* s, void* element, size_t old_size, size_t new_size)
+/// Works as `stack_resize_element_align()` otherwise.
+/// @return The (possibly moved) element.
+static inline void* stack_resize_element(stack_t* s, void* element, size_t old_size, size_t new_size)
 {
-  stack_resize_element_align(s, element, old_size, new_size, DEFAULT_ALIGN);
+  return stack_resize_element_align(s, element, old_size, new_size, DEFAULT_ALIGN);
 }
 
+/// @brief ---INTERNAL FUNCTION---
+/// Checks the header and the canary of the last element in `BASE_DEBUG` builds,
+/// and terminates the program if either was overwritten.
+void stack_check_top(stack_t* s, const char* func);
+
 /// @brief Removes the last element from the stack. 
 static inline void stack_pop(stack_t* s)
 {
@@ -288,8 +775,17 @@ static inline void stack_pop(stack_t* s)
     return;
   }
 
-  s->curr_hdr = s->curr_hdr->linked_hdr;
-  s->curr_offset = (uintptr_t)s->curr_hdr + sizeof(hdr_t); 
+#ifdef BASE_DEBUG
+  stack_check_top(s, "stack_pop");
+#endif
+  hdr_t* hdr = s->curr_hdr;
+  size_t end = s->curr_offset;
+  TRACE(TRACE_FREE, TRACE_STACK, s, (unsigned char*)hdr + sizeof(hdr_t), NULL, 0, 0);
+  s->curr_hdr = hdr->linked_hdr;
+  s->curr_offset = (size_t)((unsigned char*)hdr - s->buf);
+  MEM_ASAN_POISON(s->buf + s->curr_offset, end - s->curr_offset);
+  STATS_FREE(&s->stats, 0);
+  STATS_USAGE(&s->stats, s->curr_offset);
 }
 
 /// @brief Sets the internal offset to 0, allowing the buffer to
@@ -302,10 +798,24 @@ static inline void stack_clear(stack_t* s)
     return;
   }
 
+#ifdef BASE_DEBUG
+  stack_check_top(s, "stack_clear");
+#endif
+  MEM_ASAN_POISON(s->buf, s->curr_offset);
   s->curr_hdr = NULL;
   s->curr_offset = 0;
+  STATS_USAGE(&s->stats, 0);
+  TRACE(TRACE_FREE_ALL, TRACE_STACK, s, NULL, NULL, 0, 0);
 }
 
+/// @brief Returns the statistics of the stack, see `alloc_stats_t`.
+alloc_stats_t stack_stats(stack_t* s);
+
+/// @brief Wraps the stack into an `allocator_t`. Freeing only
+/// works for the last allocation, as with `stack_pop()`. Resizing the
+/// last allocation happens in place.
+allocator_t stack_allocator(stack_t* s);
+
 /* 
   --- POOL ALLOCATOR ---
 
@@ -313,20 +823,47 @@ static inline void stack_clear(stack_t* s)
   each occupying slots of uniform size, so there will be a significant
   amount of fragmentation if the elements are widely varying in size.
   Allocation is as fast as with the linear allocators.  
+  A pool initialized with `pool_init()` is limited to the given buffer.
+  A growable pool, initialized with `pool_init_growable()`, allocates
+  slabs of `slab_size` bytes on demand, either from the heap or from a
+  parent arena. Slabs are aligned to their size, so the slab of a slot
+  is found by masking its address, and each slab keeps its own free list.
+  Optionally, a slab that becomes entirely free is given back to the heap.
+  Slots that were never used are handed out from a bump pointer, and only
+  freed slots go through the free list, so initializing or resetting a pool
+  takes constant time and never touches untouched memory.
 
 */
 
+typedef struct pool_slab {
+  struct pool_slab* next;
+  struct pool_slab* prev;
+  struct pool* pool;
+  hdr_t* free_hdr;
+  size_t used;
+  size_t bump_offset;
+} pool_slab_t;
+
 typedef struct pool {
   unsigned char* buf;
   hdr_t* curr_hdr;
   size_t size;
+  size_t bump_offset;
   size_t slot_size;
+  size_t slab_size;
+  uintptr_t align;
+  pool_slab_t* partial;
+  pool_slab_t* full;
+  arena_t* parent;
+  bool reclaim;
+  alloc_stats_t stats;
 } pool_t;
 
 /// @brief Initializes a pool allocator. The buffer might live on either
 /// stack or heap and is therefore needed to be given as an argument.
 /// This function allows for manual alignment of the buffer and slot sizes
 /// (probably rarely of use). For default alignment, use `pool_init()` instead.
+/// Slots are at least as big as a pointer (two in `BASE_DEBUG` builds).
 void pool_init_align(pool_t* p, void* buf, size_t size, size_t slot_size, uintptr_t align);
 
 /// @brief Initializes a pool allocator. The buffer might live on either
@@ -338,18 +875,142 @@ static inline void pool_init(pool_t* p, void* buf, size_t size, size_t slot_size
   pool_init_align(p, buf, size, slot_size, DEFAULT_ALIGN);
 }
 
+/// @brief Initializes a growable pool with manual alignment. Slabs of `slab_size`
+/// bytes (rounded up to a power of 2) are taken from `parent`, or from the heap if
+/// `parent` is null. With `reclaim` set, heap slabs are freed again as soon as
+/// all their slots are free, as long as another slab has free slots.
+/// For default alignment, use `pool_init_growable()` instead.
+void pool_init_growable_align(pool_t* p, size_t slot_size, size_t slab_size, arena_t* parent, bool reclaim, uintptr_t align);
+
+/// @brief Initializes a growable pool with default alignment. For manual alignment,
+/// use `pool_init_growable_align()` instead.
+static inline void pool_init_growable(pool_t* p, size_t slot_size, size_t slab_size, arena_t* parent, bool reclaim)
+{
+  pool_init_growable_align(p, slot_size, slab_size, parent, reclaim, DEFAULT_ALIGN);
+}
+
 /// @brief Allocates a block of memory of fixed size, as specified in
-/// `pool_init()` or `pool_init_align`.
+/// `pool_init()` or `pool_init_align`. A growable pool adds a slab if needed.
 /// @return A pointer to the allocated block, or null if the pool itself
-/// is null, or not initialized.
+/// is null, or not initialized, or exhausted.
 void* pool_alloc(pool_t* p);
 
-/// @brief Marks the given slot as free, nulls the pointer.
+/// @brief Same as `pool_alloc()`, but leaves the slot uninitialized.
+void* pool_alloc_nozero(pool_t* p);
+
+/// @brief Marks the given slot as free, nulls the pointer. A fixed pool warns
+/// about addresses outside its buffer. A growable pool reads the header of the
+/// slab the address would belong to, so freeing an address that didn't come
+/// from the pool is undefined behaviour there, except in `BASE_DEBUG` builds,
+/// which look the slab up in the pool first and warn.
 void  pool_free(pool_t* p, void* slot);
 
-/// @brief Marks all slots in the pool as free. 
+/// @brief Allocates `n` slots in a single pass and stores them in `slots`.
+/// A growable pool adds as many slabs as needed.
+/// @return The number of slots allocated, which is less than `n` only if
+/// a fixed pool runs out.
+size_t pool_alloc_n(pool_t* p, void** slots, size_t n);
+
+/// @brief Same as `pool_alloc_n()`, but leaves the slots uninitialized.
+size_t pool_alloc_n_nozero(pool_t* p, void** slots, size_t n);
+
+/// @brief Marks the given `n` slots as free. With a fixed pool, they are
+/// spliced into the free list at once. Checks the slots as `pool_free()` does.
+void  pool_free_n(pool_t* p, void** slots, size_t n);
+
+/// @brief Marks a whole chain of slots as free, which the caller linked
+/// through their first pointer (like `hdr_t`), from `first` to `last`.
+/// Takes constant time with a fixed pool, where only `first` and `last`
+/// are checked for bounds; a growable pool walks the chain.
+void  pool_free_chain(pool_t* p, void* first, void* last);
+
+/// @brief Marks all slots in the pool as free. A growable pool keeps its
+/// slabs, unless it reclaims them, in which case only one is kept.
 void  pool_free_all(pool_t* p);
 
+/// @brief Frees the heap slabs of a growable pool. Slabs from a parent arena
+/// are left to the arena. For a pool with a user-supplied buffer, this only
+/// resets the pool.
+void  pool_release(pool_t* p);
+
+/// @brief Returns the statistics of the pool, see `alloc_stats_t`. With
+/// `BASE_STATS`, `pool_free_chain()` walks the chain of a fixed pool to count it.
+alloc_stats_t pool_stats(pool_t* p);
+
+/// @brief Wraps the pool into an `allocator_t`. Allocations larger
+/// than a slot fail.
+allocator_t pool_allocator(pool_t* p);
+
+/* 
+  --- CONCURRENT POOL ALLOCATOR ---
+
+  Pool allocator that can be shared between threads without a lock.
+  Free slots form a lock-free stack; its head packs the index of the
+  top slot with a counter that changes on every update, which protects
+  against the ABA problem. On top of that, every thread keeps a small
+  magazine of slots per pool, which it refills from and flushes to the
+  shared stack in batches of `CPOOL_MAGAZINE_SIZE / 2`. Most allocations
+  and frees therefore touch no shared memory at all. Once the stack is
+  empty, batches of untouched slots are claimed from an atomic bump index.
+  A thread should call `cpool_thread_flush()` before it exits, and a pool
+  has to outlive the magazines of all threads that used it.
+
+*/
+
+#ifndef CPOOL_MAGAZINE_SIZE
+  #define CPOOL_MAGAZINE_SIZE 64
+#endif
+
+// Number of pools a thread can cache slots for at the same time.
+#ifndef CPOOL_THREAD_CACHES
+  #define CPOOL_THREAD_CACHES 8
+#endif
+
+typedef struct cpool {
+  unsigned char* buf;
+  size_t size;
+  size_t slot_size;
+  uint32_t slot_count;
+  uint64_t id;
+  alignas(CACHE_LINE_SIZE) _Atomic(uint64_t) head;
+  _Atomic(uint32_t) bump;
+} cpool_t;
+
+/// @brief Initializes a concurrent pool. Slot and buffer alignment work as with
+/// `pool_init_align()`. For default alignment, use `cpool_init()` instead.
+/// Not thread-safe itself.
+void cpool_init_align(cpool_t* p, void* buf, size_t size, size_t slot_size, uintptr_t align);
+
+/// @brief Initializes a concurrent pool with default alignment. For manual
+/// alignment, use `cpool_init_align()` instead. Not thread-safe itself.
+static inline void cpool_init(cpool_t* p, void* buf, size_t size, size_t slot_size)
+{
+  cpool_init_align(p, buf, size, slot_size, DEFAULT_ALIGN);
+}
+
+/// @brief Allocates a slot, from the calling thread's magazine if possible.
+/// Thread-safe.
+/// @return A pointer to the slot, or null if the pool is exhausted.
+void* cpool_alloc(cpool_t* p);
+
+/// @brief Same as `cpool_alloc()`, but leaves the slot uninitialized.
+void* cpool_alloc_nozero(cpool_t* p);
+
+/// @brief Returns a slot to the calling thread's magazine, or to the pool
+/// if the magazine is full. Thread-safe.
+void cpool_free(cpool_t* p, void* slot);
+
+/// @brief Marks all slots as free, including those cached by other threads,
+/// whose magazines are discarded. No other thread may use the pool meanwhile.
+void cpool_free_all(cpool_t* p);
+
+/// @brief Returns all slots cached by the calling thread to their pools.
+void cpool_thread_flush(void);
+
+/// @brief Wraps the concurrent pool into an `allocator_t`. Allocations
+/// larger than a slot fail. Thread-safe.
+allocator_t cpool_allocator(cpool_t* p);
+
 /* 
   --- FREE LIST ALLOCATOR ---
 
@@ -357,18 +1018,22 @@ void  pool_free_all(pool_t* p);
   random access of all its elements. Depending on the allocation policy,
   either the first or best fitting free stretch of memory is allocated.
   Neighboring free blocks are concatenated. Each free or occupied block
-  is preceded by a (currently) 16-byte header.
+  is preceded by a (currently) 24-byte header, which links both the following
+  and the preceding block, so freeing merges neighbors in O(1) and doesn't
+  need to be told the size of the block.
 
 */
 
 typedef struct fl_hdr {
   struct fl_hdr* linked_hdr;
+  struct fl_hdr* prev_hdr;
   size_t block_size;
 } fl_hdr_t;
 
 typedef struct free_list {
   unsigned char* buf;
   size_t size;
+  alloc_stats_t stats;
 } free_list_t;
 
 typedef enum {
@@ -412,17 +1077,28 @@ static inline void* free_list_alloc(free_list_t* fl, size_t size, fl_policy poli
   return free_list_alloc_align(fl, size, policy, DEFAULT_ALIGN);
 }
 
-/// @brief Frees the given block. Tries to merge with neighboring blocks, if they are free
-/// themselves. Calculates all sizes with given alignment value (which should probably match
-/// the one used for allocation). For working with default alignment, use `free_list_free()` instead.
+/// @brief Same as `free_list_alloc_align()`, but leaves the memory uninitialized.
+void* free_list_alloc_nozero_align(free_list_t* fl, size_t size, fl_policy policy, uintptr_t align);
+
+/// @brief Same as `free_list_alloc()`, but leaves the memory uninitialized.
+static inline void* free_list_alloc_nozero(free_list_t* fl, size_t size, fl_policy policy)
+{
+  return free_list_alloc_nozero_align(fl, size, policy, DEFAULT_ALIGN);
+}
+
+/// @brief Frees the given block. Merges it with neighboring blocks, if they are free
+/// themselves. Calculates all sizes with given alignment value (which should match
+/// the one used for allocation). The size of the block is taken from its header;
+/// `element_size` is only checked against it and may be 0. For working with default
+/// alignment, use `free_list_free()` instead.
 void free_list_free_align(free_list_t* fl, void* element, size_t element_size, uintptr_t align);
 
-/// @brief Frees the given block. Tries to merge with neighboring blocks, if they are free
+/// @brief Frees the given block. Merges it with neighboring blocks, if they are free
 /// themselves. Calculates all sizes with the default alignment value.
-/// For working with default alignment, use `free_list_free_align()` instead.
-static inline void free_list_free(free_list_t* fl, void* element, size_t element_size)
+/// For working with manual alignment, use `free_list_free_align()` instead.
+static inline void free_list_free(free_list_t* fl, void* element)
 {
-  free_list_free_align(fl, element, element_size, DEFAULT_ALIGN);
+  free_list_free_align(fl, element, 0, DEFAULT_ALIGN);
 }
 
 /// @brief Clears the entire buffer, stores the then available size as 
@@ -445,3 +1121,90 @@ void free_list_find_first(free_list_t* fl, size_t size, fl_hdr_t** found_hdr, fl
 /// @brief ---INTERNAL FUNCTION---
 /// Finds the smallest memory block that still accommodates the given size.
 void free_list_find_best(free_list_t* fl, size_t size, fl_hdr_t** found_hdr, fl_hdr_t** prev_hdr);
+
+/// @brief Returns the statistics of the free list, see `alloc_stats_t`.
+/// Walks all blocks to find the free ones.
+alloc_stats_t free_list_stats(free_list_t* fl);
+
+/// @brief Wraps the free list into an `allocator_t` that allocates
+/// according to the given policy. It supports alignments up to `DEFAULT_ALIGN`.
+allocator_t free_list_allocator(free_list_t* fl, fl_policy policy);
+
+/* 
+  --- TLSF ALLOCATOR ---
+
+  Two-level segregated fit allocator, a sibling of the free list with
+  O(1) allocation and freeing regardless of the number of blocks. Free
+  blocks are kept in lists by size class: the first level splits sizes
+  by powers of 2, the second level splits each of those into
+  `TLSF_SL_COUNT` linear steps. Two bitmaps tell which lists are non-empty,
+  so a good fit is found with two bit scans. Every block is preceded by a
+  (currently) 16-byte header that also links the physically preceding
+  block, so neighbors are merged without searching, and blocks are freed
+  without giving their size.
+
+*/
+
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 40
+
+typedef struct tlsf_block {
+  struct tlsf_block* prev_phys;
+  size_t size;
+  struct tlsf_block* next_free;
+  struct tlsf_block* prev_free;
+} tlsf_block_t;
+
+typedef struct tlsf {
+  unsigned char* buf;
+  size_t size;
+  uint64_t fl_bitmap;
+  uint32_t sl_bitmap[TLSF_FL_COUNT];
+  tlsf_block_t* free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+  alloc_stats_t stats;
+} tlsf_t;
+
+/// @brief Initializes the allocator. The buffer might live on either stack
+/// or heap, so it has to be given as an argument. If it's too small to hold
+/// a block, the allocator is left empty and every allocation fails.
+void tlsf_init(tlsf_t* t, void* buf, size_t size);
+
+/// @brief Allocates a block of at least the given size, with manual alignment.
+/// For default alignment, use `tlsf_alloc()` instead.
+/// @return A pointer to the block, or null if no free block is large enough.
+void* tlsf_alloc_align(tlsf_t* t, size_t size, uintptr_t align);
+
+/// @brief Allocates a block of at least the given size, with default alignment.
+/// For manual alignment, use `tlsf_alloc_align()` instead.
+/// @return A pointer to the block, or null if no free block is large enough.
+static inline void* tlsf_alloc(tlsf_t* t, size_t size)
+{
+  return tlsf_alloc_align(t, size, DEFAULT_ALIGN);
+}
+
+/// @brief Same as `tlsf_alloc_align()`, but leaves the memory uninitialized.
+void* tlsf_alloc_nozero_align(tlsf_t* t, size_t size, uintptr_t align);
+
+/// @brief Same as `tlsf_alloc()`, but leaves the memory uninitialized.
+static inline void* tlsf_alloc_nozero(tlsf_t* t, size_t size)
+{
+  return tlsf_alloc_nozero_align(t, size, DEFAULT_ALIGN);
+}
+
+/// @brief Frees the given block and merges it with free neighbors.
+void tlsf_free(tlsf_t* t, void* ptr);
+
+/// @brief Frees all blocks at once.
+void tlsf_free_all(tlsf_t* t);
+
+/// @brief Returns the usable size of an allocated block, which may be
+/// larger than requested.
+size_t tlsf_block_size(void* ptr);
+
+/// @brief Returns the statistics of the allocator, see `alloc_stats_t`.
+/// Walks all blocks to find the free ones.
+alloc_stats_t tlsf_stats(tlsf_t* t);
+
+/// @brief Wraps the TLSF allocator into an `allocator_t`.
+allocator_t tlsf_allocator(tlsf_t* t);
@@ -0,0 +1,12 @@
+#pragma once
+
+/*
+  --- BUILD CONFIGURATION ---
+
+  The `BASE_*` defines that the library was compiled with. `BASE_STATS`,
+  `BASE_TRACE` and `BASE_DEBUG` change what the header inlines do, so code
+  that includes the headers has to see the same ones. `make lib` writes them
+  here for the installed headers; in the source tree, this file stays empty
+  and the defines come from the command line.
+
+*/
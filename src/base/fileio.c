@@ -27,7 +27,7 @@ void dir_ensure(const char* path) {
 void file_write(const char* path, const char* text) {
   FILE* file = fopen(path, "a");
   if (!file) return;
-  fprintf(file, text);
+  fputs(text, file);
   fclose(file);
 }
   
@@ -0,0 +1,367 @@
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "base/gpa.h"
+#include "base/log.h"
+#include "base/mem_utils.h"
+#include "base/vmem.h"
+
+#define GPA_SMALL_ALIGN ((size_t)16)
+
+typedef struct gpa_class {
+  pool_t pool;
+  mtx_t lock;
+  size_t slot_size;
+  size_t in_use;
+  uint32_t cache_cap;
+} gpa_class_t;
+
+/// Header of a large allocation. It starts like a `pool_slab_t` without a
+/// pool, which is how `gpa_free()` tells it apart from a slab.
+typedef struct gpa_large {
+  pool_slab_t slab;
+  void* reserved;
+  size_t reserved_size;
+  size_t size;
+} gpa_large_t;
+
+typedef struct gpa_cache {
+  uint32_t count[GPA_NUM_CLASSES];
+  void* slots[GPA_NUM_CLASSES][GPA_CACHE_SIZE];
+} gpa_cache_t;
+
+static gpa_class_t gpa_classes[GPA_NUM_CLASSES];
+static once_flag gpa_once = ONCE_FLAG_INIT;
+static atomic_bool gpa_ready = false;
+static atomic_size_t gpa_large_count = 0;
+static atomic_size_t gpa_large_reserved = 0;
+static THREAD_LOCAL gpa_cache_t gpa_cache;
+
+static inline size_t gpa_class_size(size_t c)
+{
+  if (c < 8)
+    return (c + 1) * GPA_SMALL_ALIGN;
+
+  size_t k = 7 + (c - 8) / 4;
+  size_t step = (size_t)1 << (k - 2);
+
+  return ((size_t)1 << k) + ((c - 8) % 4 + 1) * step;
+}
+
+static inline size_t gpa_class_of(size_t size)
+{
+  if (size <= 128)
+    return size ? (size - 1) / GPA_SMALL_ALIGN : 0;
+
+  unsigned k = highest_bit(size - 1);
+  size_t step = (size_t)1 << (k - 2);
+
+  return 8 + (k - 7) * 4 + (size - ((size_t)1 << k) - 1) / step;
+}
+
+/// Largest power of 2 the slot size of class `c` is a multiple of. The pool of
+/// the class aligns its slots to it, so over-aligned requests can use the class.
+static inline size_t gpa_class_align(size_t c)
+{
+  size_t slot_size = gpa_class_size(c);
+  return slot_size & (~slot_size + 1);
+}
+
+/// Smallest class at or above `c` whose slots are aligned to `align`, or
+/// `GPA_NUM_CLASSES` if there is none.
+static inline size_t gpa_class_aligned(size_t c, size_t align)
+{
+  while (c < GPA_NUM_CLASSES && gpa_class_align(c) < align)
+    ++c;
+
+  return c;
+}
+
+static void gpa_init(void)
+{
+  for (size_t c = 0; c < GPA_NUM_CLASSES; ++c) {
+    gpa_class_t* cls = &gpa_classes[c];
+    size_t cache_cap = GPA_CACHE_BYTES / gpa_class_size(c);
+
+    cls->slot_size = gpa_class_size(c);
+    cls->in_use = 0;
+    cls->cache_cap = (uint32_t)(cache_cap < 2 ? 2 : cache_cap > GPA_CACHE_SIZE ? GPA_CACHE_SIZE : cache_cap);
+    pool_init_growable_align(&cls->pool, cls->slot_size, GPA_SLAB_SIZE, NULL, true, gpa_class_align(c));
+
+    if (mtx_init(&cls->lock, mtx_plain) != thrd_success) {
+      flog(LOG_ERROR, "gpa_init(): mutex creation failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  atomic_store(&gpa_ready, true);
+}
+
+static inline void gpa_ensure_init(void)
+{
+  if (!atomic_load_explicit(&gpa_ready, memory_order_acquire))
+    call_once(&gpa_once, gpa_init);
+}
+
+static void* gpa_alloc_large(size_t size, size_t align)
+{
+  size_t page = vmem_page_size();
+  size_t offset = (size_t)align_size(sizeof(gpa_large_t), align > GPA_SMALL_ALIGN ? align : GPA_SMALL_ALIGN);
+
+  if (offset >= GPA_SLAB_SIZE || size > SIZE_MAX - offset - 2 * GPA_SLAB_SIZE) {
+    flog(LOG_WARNING, "gpa_alloc(): %zu bytes with alignment %zu not supported", size, align);
+    return NULL;
+  }
+
+  size_t used = (size_t)align_size(offset + size, page);
+  size_t reserved_size = used + GPA_SLAB_SIZE;
+  unsigned char* reserved = (unsigned char*)vmem_reserve(reserved_size);
+
+  if (!reserved)
+    return NULL;
+
+  // The header goes to a slab boundary, so masking the returned address finds it.
+  unsigned char* base = (unsigned char*)align_ptr((uintptr_t)reserved, GPA_SLAB_SIZE);
+
+  if (!vmem_commit(base, used)) {
+    vmem_release(reserved, reserved_size);
+    return NULL;
+  }
+
+  gpa_large_t* large = (gpa_large_t*)base;
+  large->slab.pool = NULL;
+  large->reserved = reserved;
+  large->reserved_size = reserved_size;
+  large->size = used - offset;
+
+  atomic_fetch_add_explicit(&gpa_large_count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&gpa_large_reserved, reserved_size, memory_order_relaxed);
+  TRACE(TRACE_ALLOC, TRACE_GPA, NULL, base + offset, NULL, size, align);
+
+  return base + offset;
+}
+
+static void gpa_free_large(gpa_large_t* large)
+{
+  atomic_fetch_sub_explicit(&gpa_large_count, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&gpa_large_reserved, large->reserved_size, memory_order_relaxed);
+  vmem_release(large->reserved, large->reserved_size);
+}
+
+static inline pool_slab_t* gpa_slab_of(void* ptr)
+{
+  return (pool_slab_t*)((uintptr_t)ptr & ~(uintptr_t)(GPA_SLAB_SIZE - 1));
+}
+
+void* gpa_alloc_align(size_t size, size_t align)
+{
+  if (!is_pow2(align)) {
+    flog(LOG_ERROR, "gpa_alloc_align(): Given alignment no power of 2");
+    exit(EXIT_FAILURE);
+  }
+
+  if (size > GPA_MAX_SMALL || align > GPA_MAX_SMALL)
+    return gpa_alloc_large(size, align);
+
+  gpa_ensure_init();
+
+  size_t c = gpa_class_of(size);
+
+  if (align > GPA_SMALL_ALIGN && (c = gpa_class_aligned(c, align)) == GPA_NUM_CLASSES)
+    return gpa_alloc_large(size, align);
+
+  uint32_t* count = &gpa_cache.count[c];
+
+  if (*count == 0) {
+    gpa_class_t* cls = &gpa_classes[c];
+
+    mtx_lock(&cls->lock);
+    TRACE_SUSPEND();
+    *count = (uint32_t)pool_alloc_n_nozero(&cls->pool, gpa_cache.slots[c], cls->cache_cap / 2 + 1);
+    TRACE_RESUME();
+    cls->in_use += *count;
+    mtx_unlock(&cls->lock);
+  }
+
+  void* ptr = gpa_cache.slots[c][--*count];
+  TRACE(TRACE_ALLOC, TRACE_GPA, NULL, ptr, NULL, size, align);
+
+  return ptr;
+}
+
+void* gpa_alloc(size_t size)
+{
+  return gpa_alloc_align(size, GPA_SMALL_ALIGN);
+}
+
+void* gpa_calloc(size_t num, size_t size)
+{
+  if (size && num > SIZE_MAX / size)
+    return NULL;
+
+  void* ptr = gpa_alloc(num * size);
+  return ptr ? memset(ptr, 0, num * size) : NULL;
+}
+
+void gpa_free(void* ptr)
+{
+  if (!ptr)
+    return;
+
+  TRACE(TRACE_FREE, TRACE_GPA, NULL, ptr, NULL, 0, 0);
+  pool_slab_t* slab = gpa_slab_of(ptr);
+
+  if (!slab->pool) {
+    gpa_free_large((gpa_large_t*)slab);
+    return;
+  }
+
+  size_t c = (size_t)((gpa_class_t*)slab->pool - gpa_classes);
+  gpa_class_t* cls = &gpa_classes[c];
+  uint32_t* count = &gpa_cache.count[c];
+
+  if (*count == cls->cache_cap) {
+    uint32_t batch = cls->cache_cap / 2;
+    *count -= batch;
+
+    mtx_lock(&cls->lock);
+    TRACE_SUSPEND();
+    pool_free_n(&cls->pool, gpa_cache.slots[c] + *count, batch);
+    TRACE_RESUME();
+    cls->in_use -= batch;
+    mtx_unlock(&cls->lock);
+  }
+
+  gpa_cache.slots[c][(*count)++] = ptr;
+}
+
+size_t gpa_usable_size(void* ptr)
+{
+  VALIDATE_PTR(ptr, 0);
+
+  pool_slab_t* slab = gpa_slab_of(ptr);
+
+  if (!slab->pool)
+    return ((gpa_large_t*)slab)->size;
+
+  return slab->pool->slot_size;
+}
+
+void* gpa_realloc(void* ptr, size_t size)
+{
+  if (!ptr)
+    return gpa_alloc(size);
+
+  size_t old_size = gpa_usable_size(ptr);
+
+  if (size <= old_size && (size > GPA_MAX_SMALL || old_size <= GPA_MAX_SMALL)) {
+    TRACE(TRACE_RESIZE, TRACE_GPA, NULL, ptr, ptr, size, GPA_SMALL_ALIGN);
+    return ptr;
+  }
+
+  void* new_ptr = gpa_alloc(size);
+
+  if (!new_ptr)
+    return NULL;
+
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  gpa_free(ptr);
+
+  return new_ptr;
+}
+
+void gpa_thread_flush(void)
+{
+  if (!atomic_load_explicit(&gpa_ready, memory_order_acquire))
+    return;
+
+  for (size_t c = 0; c < GPA_NUM_CLASSES; ++c) {
+    uint32_t count = gpa_cache.count[c];
+
+    if (count == 0)
+      continue;
+
+    gpa_class_t* cls = &gpa_classes[c];
+
+    mtx_lock(&cls->lock);
+    TRACE_SUSPEND();
+    pool_free_n(&cls->pool, gpa_cache.slots[c], count);
+    TRACE_RESUME();
+    cls->in_use -= count;
+    mtx_unlock(&cls->lock);
+
+    gpa_cache.count[c] = 0;
+  }
+}
+
+gpa_stats_t gpa_stats(void)
+{
+  gpa_stats_t stats = { 0 };
+
+  stats.large_count = atomic_load_explicit(&gpa_large_count, memory_order_relaxed);
+  stats.large_reserved = atomic_load_explicit(&gpa_large_reserved, memory_order_relaxed);
+
+  if (!atomic_load_explicit(&gpa_ready, memory_order_acquire))
+    return stats;
+
+  for (size_t c = 0; c < GPA_NUM_CLASSES; ++c) {
+    gpa_class_t* cls = &gpa_classes[c];
+
+    mtx_lock(&cls->lock);
+    stats.small_reserved += cls->pool.size;
+    stats.small_in_use += cls->in_use * cls->slot_size;
+    stats.class_in_use[c] = cls->in_use;
+    mtx_unlock(&cls->lock);
+  }
+
+  return stats;
+}
+
+void gpa_log_stats(void)
+{
+  gpa_stats_t stats = gpa_stats();
+
+  flog(LOG_INFO, "gpa: small %zu of %zu bytes in use, %zu large allocations in %zu bytes",
+    stats.small_in_use, stats.small_reserved, stats.large_count, stats.large_reserved);
+
+  for (size_t c = 0; c < GPA_NUM_CLASSES; ++c) {
+    if (stats.class_in_use[c] > 0)
+      flog(LOG_INFO, "gpa: class %zu (%zu bytes): %zu slots in use", c, gpa_class_size(c), stats.class_in_use[c]);
+  }
+}
+
+static void* gpa_allocator_alloc(void* ctx, size_t size, uintptr_t align)
+{
+  return gpa_alloc_align(size, (size_t)align);
+}
+
+static void* gpa_allocator_resize(void* ctx, void* ptr, size_t old_size, size_t new_size, uintptr_t align)
+{
+  if (align <= GPA_SMALL_ALIGN)
+    return gpa_realloc(ptr, new_size);
+
+  if (ptr && new_size <= gpa_usable_size(ptr)) {
+    TRACE(TRACE_RESIZE, TRACE_GPA, NULL, ptr, ptr, new_size, align);
+    return ptr;
+  }
+
+  void* new_ptr = gpa_alloc_align(new_size, (size_t)align);
+
+  if (new_ptr && ptr) {
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    gpa_free(ptr);
+  }
+
+  return new_ptr;
+}
+
+static void gpa_allocator_free(void* ctx, void* ptr, size_t size)
+{
+  gpa_free(ptr);
+}
+
+allocator_t gpa_allocator(void)
+{
+  allocator_t allocator = { gpa_allocator_alloc, gpa_allocator_resize, gpa_allocator_free, NULL };
+  return allocator;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/allocators.h"
+
+/*
+  --- GENERAL PURPOSE ALLOCATOR ---
+
+  Replacement for `malloc()` and friends, composed of the allocators in
+  `allocators.h`. Requests of up to `GPA_MAX_SMALL` bytes go to one of 40
+  size classes: steps of 16 bytes up to 128, then four classes per power
+  of 2, which keeps the internal waste below 25%. Each class is a growable
+  pool with its own lock, whose slabs of `GPA_SLAB_SIZE` bytes are aligned
+  to their size, so `gpa_free()` finds the owning pool by masking the
+  address. Every thread caches a few slots per class and only takes the
+  lock to refill or flush its cache in batches.
+  The pool of a class aligns its slots to the largest power of 2 dividing
+  the slot size, so an over-aligned request takes the smallest class at or
+  above its size whose slots are aligned enough.
+  Larger requests, and alignments beyond `GPA_MAX_SMALL`, get their own
+  mapping from the OS, behind a header at the same slab-aligned position.
+  The allocator initializes itself on first use. A thread should call
+  `gpa_thread_flush()` before it exits, or its cached slots stay reserved.
+
+*/
+
+#ifndef GPA_SLAB_SIZE
+  #define GPA_SLAB_SIZE ((size_t)256 * 1024)
+#endif
+
+#ifndef GPA_MAX_SMALL
+  #define GPA_MAX_SMALL ((size_t)32 * 1024)
+#endif
+
+#define GPA_NUM_CLASSES 40
+
+// Number of slots a thread caches per size class, at most.
+#ifndef GPA_CACHE_SIZE
+  #define GPA_CACHE_SIZE 32
+#endif
+
+// Bytes a thread caches per size class, at most.
+#ifndef GPA_CACHE_BYTES
+  #define GPA_CACHE_BYTES ((size_t)64 * 1024)
+#endif
+
+typedef struct gpa_stats {
+  size_t small_reserved;                      // Bytes in slabs of all size classes.
+  size_t small_in_use;                        // Bytes in slots handed to threads, including their caches.
+  size_t large_count;                         // Number of live large allocations.
+  size_t large_reserved;                      // Bytes mapped for large allocations.
+  size_t class_in_use[GPA_NUM_CLASSES];       // Slots handed to threads, per size class.
+} gpa_stats_t;
+
+/// @brief Allocates `size` bytes of uninitialized memory, aligned to `DEFAULT_ALIGN`.
+/// @return A pointer to the memory, or null if a large block couldn't be mapped.
+/// Terminates the program if a slab can't be allocated, as the pools do.
+void* gpa_alloc(size_t size);
+
+/// @brief Allocates `size` bytes of uninitialized memory with the given
+/// alignment, which has to be a power of 2.
+void* gpa_alloc_align(size_t size, size_t align);
+
+/// @brief Allocates `num * size` bytes of zeroed memory.
+void* gpa_calloc(size_t num, size_t size);
+
+/// @brief Resizes a block from the allocator, moving it if needed. Works as
+/// `gpa_alloc()` if `ptr` is null.
+/// @return The (possibly moved) block, or null on failure, in which case
+/// the old block stays valid.
+void* gpa_realloc(void* ptr, size_t size);
+
+/// @brief Frees a block from the allocator. Does nothing if `ptr` is null.
+void gpa_free(void* ptr);
+
+/// @brief Returns the number of bytes usable in the given block, which
+/// may be more than requested.
+size_t gpa_usable_size(void* ptr);
+
+/// @brief Returns the slots cached by the calling thread to their size classes.
+void gpa_thread_flush(void);
+
+/// @brief Collects the current usage of the allocator. Slots in the caches
+/// of threads count as in use.
+gpa_stats_t gpa_stats(void);
+
+/// @brief Writes the current usage of the allocator to the log.
+void gpa_log_stats(void);
+
+/// @brief Wraps the general purpose allocator into an `allocator_t`.
+allocator_t gpa_allocator(void);
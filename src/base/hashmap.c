@@ -0,0 +1,374 @@
+#include "base/hashmap.h"
+
+#if !defined(HASHMAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+  #define HASHMAP_SSE2
+  #include <emmintrin.h>
+#endif
+
+#define HM_EMPTY   ((unsigned char)0x80)
+#define HM_DELETED ((unsigned char)0xFE)
+#define HM_NOT_FOUND SIZE_MAX
+
+/// Bit `i` of a group mask stands for the control byte at offset `i`.
+typedef uint32_t hm_mask_t;
+
+#ifdef HASHMAP_SSE2
+
+static inline hm_mask_t hm_match(const unsigned char* ctrl, unsigned char h2)
+{
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return (hm_mask_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+
+static inline hm_mask_t hm_match_empty(const unsigned char* ctrl)
+{
+  return hm_match(ctrl, HM_EMPTY);
+}
+
+/// Empty and deleted bytes are the ones with the high bit set.
+static inline hm_mask_t hm_match_free(const unsigned char* ctrl)
+{
+  return (hm_mask_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+
+#else
+
+static inline hm_mask_t hm_match(const unsigned char* ctrl, unsigned char h2)
+{
+  hm_mask_t mask = 0;
+
+  for (unsigned i = 0; i < HASHMAP_GROUP_SIZE; ++i)
+    mask |= (hm_mask_t)(ctrl[i] == h2) << i;
+
+  return mask;
+}
+
+static inline hm_mask_t hm_match_empty(const unsigned char* ctrl)
+{
+  return hm_match(ctrl, HM_EMPTY);
+}
+
+static inline hm_mask_t hm_match_free(const unsigned char* ctrl)
+{
+  hm_mask_t mask = 0;
+
+  for (unsigned i = 0; i < HASHMAP_GROUP_SIZE; ++i)
+    mask |= (hm_mask_t)(ctrl[i] >> 7) << i;
+
+  return mask;
+}
+
+#endif
+
+uint64_t hashmap_hash_bytes(const void* key, size_t key_size)
+{
+  const unsigned char* p = (const unsigned char*)key;
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ (key_size * 0xFF51AFD7ED558CCDull);
+
+  for (; key_size >= 8; key_size -= 8, p += 8) {
+    uint64_t k;
+    memcpy(&k, p, 8);
+    h = (h ^ k) * 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 29;
+  }
+
+  if (key_size > 0) {
+    uint64_t k = 0;
+    memcpy(&k, p, key_size);
+    h = (h ^ k) * 0xC4CEB9FE1A85EC53ull;
+  }
+
+  // Final avalanche, so the low bits (the home slot) and the top 7 bits
+  // stored in the control bytes both depend on every key bit.
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+
+  return h;
+}
+
+static bool hashmap_eq_bytes(const void* a, const void* b, size_t key_size)
+{
+  return memcmp(a, b, key_size) == 0;
+}
+
+/// Guesses the alignment a type of the given size needs.
+static inline size_t hm_natural_align(size_t size)
+{
+  size_t align = size ? size & (~size + 1) : 1;
+  return align < DEFAULT_ALIGN ? align : DEFAULT_ALIGN;
+}
+
+static inline size_t hm_ctrl_offset(void)
+{
+  return (size_t)align_size(sizeof(hashmap_t), DEFAULT_ALIGN);
+}
+
+static inline size_t hm_slots_offset(size_t capacity)
+{
+  return hm_ctrl_offset() + (size_t)align_size(capacity + HASHMAP_GROUP_SIZE, DEFAULT_ALIGN);
+}
+
+static inline size_t hm_alloc_size(size_t capacity, size_t slot_size)
+{
+  return hm_slots_offset(capacity) + capacity * slot_size;
+}
+
+static inline unsigned char* hm_slot(hashmap_t* map, size_t i)
+{
+  return map->slots + i * map->slot_size;
+}
+
+/// Sets a control byte, along with its mirror behind the end of the array,
+/// which lets groups be loaded at any position without wrapping around.
+static inline void hm_set_ctrl(hashmap_t* map, size_t i, unsigned char value)
+{
+  map->ctrl[i] = value;
+  map->ctrl[((i - HASHMAP_GROUP_SIZE) & (map->capacity - 1)) + HASHMAP_GROUP_SIZE] = value;
+}
+
+static hashmap_t* hm_create(size_t key_size, size_t value_size, size_t capacity, allocator_t allocator)
+{
+  size_t value_align = hm_natural_align(value_size);
+  size_t key_align = hm_natural_align(key_size);
+  size_t value_offset = (size_t)align_size(key_size, value_align);
+  size_t slot_size = (size_t)align_size(value_offset + value_size, key_align > value_align ? key_align : value_align);
+
+  hashmap_t* map = (hashmap_t*)allocator_alloc(&allocator, hm_alloc_size(capacity, slot_size), DEFAULT_ALIGN);
+
+  if (!map) {
+    flog(LOG_ERROR, "hashmap_init(): buffer allocation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  map->capacity = capacity;
+  map->occupied = 0;
+  map->deleted = 0;
+  map->key_size = key_size;
+  map->value_size = value_size;
+  map->value_offset = value_offset;
+  map->slot_size = slot_size;
+  map->hash = hashmap_hash_bytes;
+  map->eq = hashmap_eq_bytes;
+  map->allocator = allocator;
+  map->ctrl = (unsigned char*)map + hm_ctrl_offset();
+  map->slots = (unsigned char*)map + hm_slots_offset(capacity);
+
+  memset(map->ctrl, HM_EMPTY, capacity + HASHMAP_GROUP_SIZE);
+
+  return map;
+}
+
+hashmap_t* hashmap_init(size_t key_size, size_t value_size, size_t num)
+{
+  return hashmap_init_alloc(key_size, value_size, num, heap_allocator());
+}
+
+hashmap_t* hashmap_init_alloc(size_t key_size, size_t value_size, size_t num, allocator_t allocator)
+{
+  size_t capacity = (size_t)next_pow2(num + num / 7 + 1);
+
+  if (capacity < HASHMAP_GROUP_SIZE)
+    capacity = HASHMAP_GROUP_SIZE;
+
+  return hm_create(key_size, value_size, capacity, allocator);
+}
+
+void hashmap_set_fns(hashmap_t* map, hm_hash_fn hash, hm_eq_fn eq)
+{
+  VALIDATE_PTR(map);
+
+  if (map->occupied > 0) {
+    flog(LOG_WARNING, "hashmap_set_fns(): map not empty");
+    return;
+  }
+
+  map->hash = hash ? hash : hashmap_hash_bytes;
+  map->eq = eq ? eq : hashmap_eq_bytes;
+}
+
+void hashmap_free(hashmap_t* map)
+{
+  CHECK_PTR(map);
+
+  allocator_t allocator = map->allocator;
+  allocator_free(&allocator, map, hm_alloc_size(map->capacity, map->slot_size));
+}
+
+static size_t hm_find(hashmap_t* map, const void* key, uint64_t hash)
+{
+  size_t mask = map->capacity - 1;
+  size_t pos = (size_t)(hash >> 7) & mask;
+  unsigned char h2 = (unsigned char)(hash & 0x7F);
+
+  for (size_t step = HASHMAP_GROUP_SIZE;; step += HASHMAP_GROUP_SIZE) {
+    const unsigned char* group = map->ctrl + pos;
+
+    for (hm_mask_t m = hm_match(group, h2); m; m &= m - 1) {
+      size_t i = (pos + lowest_bit(m)) & mask;
+
+      if (map->eq(hm_slot(map, i), key, map->key_size))
+        return i;
+    }
+
+    if (hm_match_empty(group))
+      return HM_NOT_FOUND;
+
+    pos = (pos + step) & mask;
+  }
+}
+
+/// Returns the first empty or deleted slot on the probe sequence of `hash`.
+static size_t hm_find_free(hashmap_t* map, uint64_t hash)
+{
+  size_t mask = map->capacity - 1;
+  size_t pos = (size_t)(hash >> 7) & mask;
+
+  for (size_t step = HASHMAP_GROUP_SIZE;; step += HASHMAP_GROUP_SIZE) {
+    hm_mask_t m = hm_match_free(map->ctrl + pos);
+
+    if (m)
+      return (pos + lowest_bit(m)) & mask;
+
+    pos = (pos + step) & mask;
+  }
+}
+
+/// Moves all entries into a new allocation of the given capacity.
+static hashmap_t* hm_rehash(hashmap_t* map, size_t capacity)
+{
+  hashmap_t* new_map = hm_create(map->key_size, map->value_size, capacity, map->allocator);
+  new_map->hash = map->hash;
+  new_map->eq = map->eq;
+
+  for (size_t i = 0; i < map->capacity; ++i) {
+    if (map->ctrl[i] & 0x80)
+      continue;
+
+    unsigned char* slot = hm_slot(map, i);
+    uint64_t hash = map->hash(slot, map->key_size);
+    size_t j = hm_find_free(new_map, hash);
+
+    hm_set_ctrl(new_map, j, (unsigned char)(hash & 0x7F));
+    memcpy(hm_slot(new_map, j), slot, map->slot_size);
+  }
+
+  new_map->occupied = map->occupied;
+  hashmap_free(map);
+
+  return new_map;
+}
+
+void* hashmap_get(hashmap_t* map, const void* key)
+{
+  VALIDATE_PTR(map, NULL);
+
+  size_t i = hm_find(map, key, map->hash(key, map->key_size));
+  return i == HM_NOT_FOUND ? NULL : hm_slot(map, i) + map->value_offset;
+}
+
+void* hashmap_insert(hashmap_t** map_ptr, const void* key, bool* found)
+{
+  VALIDATE_PTR(*map_ptr, NULL);
+
+  hashmap_t* map = *map_ptr;
+  uint64_t hash = map->hash(key, map->key_size);
+  size_t i = hm_find(map, key, hash);
+
+  if (found)
+    *found = i != HM_NOT_FOUND;
+
+  if (i != HM_NOT_FOUND)
+    return hm_slot(map, i) + map->value_offset;
+
+  if (map->occupied + map->deleted + 1 > map->capacity - map->capacity / 8) {
+    // Only grow if live entries fill the map; otherwise clearing tombstones is enough.
+    size_t capacity = map->occupied + 1 > map->capacity / 2 ? map->capacity * 2 : map->capacity;
+    map = *map_ptr = hm_rehash(map, capacity);
+  }
+
+  i = hm_find_free(map, hash);
+
+  if (map->ctrl[i] == HM_DELETED)
+    --map->deleted;
+
+  hm_set_ctrl(map, i, (unsigned char)(hash & 0x7F));
+  ++map->occupied;
+
+  unsigned char* slot = hm_slot(map, i);
+  memcpy(slot, key, map->key_size);
+  memset(slot + map->value_offset, 0, map->value_size);
+
+  return slot + map->value_offset;
+}
+
+bool hashmap_remove(hashmap_t* map, const void* key)
+{
+  VALIDATE_PTR(map, false);
+
+  size_t i = hm_find(map, key, map->hash(key, map->key_size));
+
+  if (i == HM_NOT_FOUND)
+    return false;
+
+  size_t mask = map->capacity - 1;
+  size_t before = (i - HASHMAP_GROUP_SIZE) & mask;
+
+  // If no group containing this slot was ever full, no probe went past it,
+  // and the slot can become empty instead of a tombstone.
+  hm_mask_t empty_after = hm_match_empty(map->ctrl + i);
+  hm_mask_t empty_before = hm_match_empty(map->ctrl + before);
+  bool was_never_full = empty_after && empty_before &&
+    lowest_bit(empty_after) + (HASHMAP_GROUP_SIZE - 1 - highest_bit(empty_before)) < HASHMAP_GROUP_SIZE;
+
+  if (was_never_full) {
+    hm_set_ctrl(map, i, HM_EMPTY);
+  } else {
+    hm_set_ctrl(map, i, HM_DELETED);
+    ++map->deleted;
+  }
+
+  --map->occupied;
+
+  return true;
+}
+
+void hashmap_clear(hashmap_t* map)
+{
+  VALIDATE_PTR(map);
+
+  memset(map->ctrl, HM_EMPTY, map->capacity + HASHMAP_GROUP_SIZE);
+  map->occupied = 0;
+  map->deleted = 0;
+}
+
+size_t hashmap_size(hashmap_t* map)
+{
+  VALIDATE_PTR(map, 0);
+
+  return map->occupied;
+}
+
+bool hashmap_next(hashmap_t* map, size_t* iter, void** key, void** value)
+{
+  VALIDATE_PTR(map, false);
+
+  for (size_t i = *iter; i < map->capacity; ++i) {
+    if (map->ctrl[i] & 0x80)
+      continue;
+
+    unsigned char* slot = hm_slot(map, i);
+
+    if (key)
+      *key = slot;
+
+    if (value)
+      *value = slot + map->value_offset;
+
+    *iter = i + 1;
+    return true;
+  }
+
+  *iter = map->capacity;
+  return false;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/allocators.h"
+#include "base/log.h"
+#include "base/mem_utils.h"
+
+/*
+  --- HASH MAP ---
+
+  Open-addressing hash map with type-erased keys and values of fixed size,
+  laid out like the Swiss tables of Abseil: a header, followed by one
+  control byte per slot and the slots themselves, in a single allocation.
+  A control byte marks its slot as empty, deleted, or full, in which case
+  it holds 7 bits of the key's hash. Lookups compare a whole group of 16
+  control bytes at once (with SSE2 where available), so most of them touch
+  a single key. The capacity is a power of 2 and the map grows at 7/8 load.
+  Keys are hashed and compared bytewise, unless other functions are given
+  to `hashmap_set_fns()`.
+  The memory comes from any `allocator_t`. A map living in an arena doesn't
+  need `hashmap_free()`; clearing the arena drops it with everything else.
+  Pointers to values are invalidated by the next insertion.
+
+*/
+
+#ifndef HASHMAP_GROUP_SIZE
+  #define HASHMAP_GROUP_SIZE 16
+#endif
+
+typedef uint64_t (*hm_hash_fn)(const void* key, size_t key_size);
+typedef bool (*hm_eq_fn)(const void* a, const void* b, size_t key_size);
+
+typedef struct hashmap {
+  size_t capacity;
+  size_t occupied;
+  size_t deleted;
+  size_t key_size;
+  size_t value_size;
+  size_t value_offset;
+  size_t slot_size;
+  hm_hash_fn hash;
+  hm_eq_fn eq;
+  allocator_t allocator;
+  unsigned char* ctrl;
+  unsigned char* slots;
+} hashmap_t;
+
+/// @brief Creates a hash map with room for at least `num` entries.
+hashmap_t* hashmap_init(size_t key_size, size_t value_size, size_t num);
+
+/// @brief Creates a hash map with room for at least `num` entries, whose
+/// memory comes from the given allocator.
+hashmap_t* hashmap_init_alloc(size_t key_size, size_t value_size, size_t num, allocator_t allocator);
+
+/// @brief Replaces the bytewise hashing and comparison of keys, e.g. for keys
+/// that are pointers to strings. Must be called while the map is empty.
+void hashmap_set_fns(hashmap_t* map, hm_hash_fn hash, hm_eq_fn eq);
+
+/// @brief Frees the map through the allocator it was created with.
+void hashmap_free(hashmap_t* map);
+
+/// @brief Looks up the value stored under the given key.
+/// @return A pointer to the value, or null if the key isn't in the map.
+void* hashmap_get(hashmap_t* map, const void* key);
+
+/// @brief Finds the entry for the given key, or creates it with a zeroed
+/// value. The map may be re-allocated, hence the double pointer.
+/// @return A pointer to the value.
+void* hashmap_insert(hashmap_t** map, const void* key, bool* found);
+
+/// @brief Stores a value under the given key, replacing an existing one.
+/// Key and value have to be lvalues of the sizes given at creation.
+#define hashmap_put(map, key, value)\
+do {\
+  if (sizeof(key) != (map)->key_size || sizeof(value) != (map)->value_size) {\
+    flog(LOG_ERROR, "hashmap_put: key or value has not the right type");\
+    exit(EXIT_FAILURE);\
+  }\
+  \
+  memcpy(hashmap_insert(&(map), &(key), NULL), &(value), sizeof(value));\
+} while (0);
+
+/// @brief Removes the entry for the given key.
+/// @return False if the key wasn't in the map.
+bool hashmap_remove(hashmap_t* map, const void* key);
+
+/// @brief Removes all entries. Capacity remains unchanged.
+void hashmap_clear(hashmap_t* map);
+
+/// @brief Returns the number of entries in the map.
+size_t hashmap_size(hashmap_t* map);
+
+/// @brief Steps through all entries, in no particular order. Start with
+/// `*iter` set to 0; entries must not be inserted or removed meanwhile.
+/// @return False once there are no entries left.
+bool hashmap_next(hashmap_t* map, size_t* iter, void** key, void** value);
+
+/// @brief Hashes the given bytes; the default hash function of the map.
+uint64_t hashmap_hash_bytes(const void* key, size_t key_size);
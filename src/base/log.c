@@ -1,3 +1,7 @@
+#ifndef _WIN32
+  #define _DEFAULT_SOURCE
+#endif
+
 #include "log.h"
 
 #ifdef _MSC_VER
@@ -5,62 +9,909 @@
 #endif
 
 #include <sys/stat.h>
-#include <direct.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 #include <time.h>
 
 #include "base/fileio.h"
+#include "base/mem_utils.h"
+
+#define LOG_DIR "base_logs"
+#define LOG_MSG_SIZE 256
+#define LOG_LINE_SIZE 1024
+
+// How long the writer thread sleeps when there is nothing to write.
+#define LOG_WRITER_IDLE_NS 1000000L
+
+// Upper bound for a single binary record, including its header.
+#define LOG_BIN_RECORD_SIZE 1024
+#define LOG_BIN_MAX_ARGS 16
+#define LOG_BIN_SIG_CACHE 64
+
+typedef enum {
+  LOG_MODE_SYNC,
+  LOG_MODE_ASYNC,
+  LOG_MODE_BINARY
+} log_mode;
 
 char log_file[256];
-char time_str[256];
+THREAD_LOCAL char time_str[256];
 
-const char* current_time(void) {
-  time_t t = time(NULL);
-  struct tm tm = *localtime(&t);
-  sprintf(time_str, "%02dh%02dm%02ds", 
+// `localtime()` returns a buffer shared by all threads, which the writer
+// thread would race on with the callers of `flog()`.
+static struct tm log_localtime(time_t t)
+{
+  struct tm tm;
+#ifdef _WIN32
+  localtime_s(&tm, &t);
+#else
+  localtime_r(&t, &tm);
+#endif
+  return tm;
+}
+
+void log_format_time(time_t t, char* buf, size_t size)
+{
+  struct tm tm = log_localtime(t);
+  snprintf(buf, size, "%02dh%02dm%02ds",
     tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
 
+const char* current_time(void) {
+  log_format_time(time(NULL), time_str, sizeof(time_str));
   return time_str;
 }
 
 void store_startup_time(void) {
-  time_t t = time(NULL);
-  struct tm tm = *localtime(&t);
-  sprintf(log_file, "base_logs/%d-%02d-%02d__%02d-%02d.txt", 
-    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, 
+  struct tm tm = log_localtime(time(NULL));
+  sprintf(log_file, LOG_DIR "/%d-%02d-%02d__%02d-%02d.txt",
+    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
     tm.tm_hour, tm.tm_min);
 }
 
-void flog(log_type type, const char* format, ...) {
-  va_list args;
-  va_start(args, format);
+static const char* type_prefix(log_type type)
+{
+  switch (type) {
+    case LOG_INFO:    return "INFO [";
+    case LOG_WARNING: return "WARN [";
+    case LOG_ERROR:   return "ERR  [";
+    case LOG_NUM_TYPES:
+    default:          return "NONE [";
+  }
+}
 
-  char msg[256];
-  vsnprintf(msg, sizeof(msg), format, args);
-  
-  va_end(args);
+void log_format_line(char* line, size_t size, log_type type, const char* timestamp, const char* msg)
+{
+  if (type >= LOG_NUM_TYPES)
+    snprintf(line, size, "%s%s]\t%s\n", type_prefix(type), timestamp, msg);
+  else
+    snprintf(line, size, "%s%s] %s\n", type_prefix(type), timestamp, msg);
+}
 
-  char typed_msg[1024];
+bool log_next_spec(const char** format, log_spec_t* spec)
+{
+  const char* p = strchr(*format, '%');
 
-  switch (type) {
-    case LOG_INFO: 
-      snprintf(typed_msg, sizeof(typed_msg), "INFO [%s] %s\n", current_time(), msg);
+  if (!p)
+    return false;
+
+  spec->start = p++;
+  spec->width_star = false;
+  spec->prec_star = false;
+
+  while (*p && strchr("-+ #0'", *p))
+    ++p;
+
+  if (*p == '*') {
+    spec->width_star = true;
+    ++p;
+  }
+
+  while (*p >= '0' && *p <= '9')
+    ++p;
+
+  if (*p == '.') {
+    ++p;
+
+    if (*p == '*') {
+      spec->prec_star = true;
+      ++p;
+    }
+
+    while (*p >= '0' && *p <= '9')
+      ++p;
+  }
+
+  char len[3] = { 0 };
+
+  if (*p && strchr("hljztL", *p)) {
+    len[0] = *p++;
+
+    if ((len[0] == 'h' || len[0] == 'l') && *p == len[0])
+      len[1] = *p++;
+  }
+
+  bool is_long = len[0] == 'l' && len[1] == '\0';
+  bool is_llong = len[0] == 'l' && len[1] == 'l';
+
+  switch (*p) {
+    case 'd':
+    case 'i':
+      spec->kind = is_long ? LOG_ARG_LONG : is_llong ? LOG_ARG_LLONG :
+        len[0] == 'j' ? LOG_ARG_INTMAX : len[0] == 'z' ? LOG_ARG_SIZE :
+        len[0] == 't' ? LOG_ARG_PTRDIFF : LOG_ARG_INT;
       break;
 
-    case LOG_WARNING: 
-      snprintf(typed_msg, sizeof(typed_msg), "WARN [%s] %s\n", current_time(), msg);
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      spec->kind = is_long ? LOG_ARG_ULONG : is_llong ? LOG_ARG_ULLONG :
+        len[0] == 'j' ? LOG_ARG_UINTMAX : len[0] == 'z' ? LOG_ARG_SIZE :
+        len[0] == 't' ? LOG_ARG_PTRDIFF : LOG_ARG_UINT;
       break;
 
-    case LOG_ERROR:
-      snprintf(typed_msg, sizeof(typed_msg), "ERR  [%s] %s\n", current_time(), msg);
+    case 'c':
+      spec->kind = is_long ? LOG_ARG_UINT : LOG_ARG_INT;
+      break;
+
+    case 'f': case 'F':
+    case 'e': case 'E':
+    case 'g': case 'G':
+    case 'a': case 'A':
+      spec->kind = len[0] == 'L' ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+      break;
+
+    case 's':
+      // Wide strings aren't copied, only skipped.
+      spec->kind = is_long ? LOG_ARG_SKIP : LOG_ARG_STR;
+      break;
+
+    case 'p':
+      spec->kind = LOG_ARG_PTR;
+      break;
+
+    case 'n':
+      spec->kind = LOG_ARG_SKIP;
       break;
 
-    case LOG_NUM_TYPES:
     default:
-      sprintf(typed_msg, "NONE [%s]\t%s\n", current_time(), msg);
+      spec->kind = LOG_ARG_NONE;
+      break;
+  }
+
+  if (*p)
+    ++p;
+
+  spec->len = (size_t)(p - spec->start);
+  *format = p;
+
+  return true;
+}
+
+/*
+  --- WRITER THREAD ---
+
+  Shared by the asynchronous and the binary mode. `producers` counts the
+  `flog()` calls in flight, so `log_shutdown()` can wait for them before
+  freeing their buffers. `log_flush()` bumps `flush_req`, and the writer
+  acknowledges in `flush_done` after a complete pass over all buffers.
+  Once the writer is joined, everything is written, so `log_shutdown()`
+  releases all pending and late flushes by setting `flush_done` to its
+  maximum. The next start lowers it to the requests made so far.
+
+*/
+
+static struct {
+  FILE* file;
+  thrd_t thread;
+  log_overflow policy;
+  atomic_int mode;
+  bool binary;                // What the writer thread drains, `mode` may already be reset.
+  atomic_bool running;
+  atomic_size_t flush_req;
+  atomic_size_t flush_done;
+  alignas(CACHE_LINE_SIZE) atomic_size_t producers;
+} writer;
+
+static int64_t now_ns(void)
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+  --- ASYNCHRONOUS MODE ---
+
+  Bounded multi-producer ring buffer, with a sequence number per slot
+  (after Dmitry Vyukov's MPMC queue). Producers claim a slot with a single
+  CAS on `head` and format their message directly into it; the writer thread
+  is the only consumer. Timestamps are stored raw and only turned into
+  strings by the writer, so the calling thread never makes a syscall.
+
+*/
+
+typedef struct log_slot {
+  atomic_size_t seq;
+  time_t time;
+  log_type type;
+  char msg[LOG_MSG_SIZE];
+} log_slot_t;
+
+static struct {
+  log_slot_t* slots;
+  size_t mask;
+  size_t reported_drops;
+  alignas(CACHE_LINE_SIZE) atomic_size_t head;
+  alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+  atomic_size_t dropped;
+} ring;
+
+static bool ring_push(log_type type, const char* format, va_list args)
+{
+  size_t pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  log_slot_t* slot;
+
+  for (;;) {
+    slot = &ring.slots[pos & ring.mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring.head, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+
+    else if (diff < 0) {
+      if (writer.policy == LOG_OVERFLOW_DROP)
+        return false;
+
+      if (writer.policy == LOG_OVERFLOW_COUNT) {
+        atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+        return false;
+      }
+
+      thrd_yield();
+      pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    }
+
+    else
+      pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  }
+
+  slot->type = type;
+  slot->time = time(NULL);
+  vsnprintf(slot->msg, sizeof(slot->msg), format, args);
+
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  return true;
+}
+
+/// Writes every published slot to the log file and returns the number of lines written.
+static size_t ring_drain(void)
+{
+  char line[LOG_LINE_SIZE];
+  char time_buf[32];
+  size_t pos = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+  size_t count = 0;
+
+  for (;;) {
+    log_slot_t* slot = &ring.slots[pos & ring.mask];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+    if (seq != pos + 1)
+      break;
+
+    log_format_time(slot->time, time_buf, sizeof(time_buf));
+    log_format_line(line, sizeof(line), slot->type, time_buf, slot->msg);
+    fputs(line, writer.file);
+
+    atomic_store_explicit(&slot->seq, pos + ring.mask + 1, memory_order_release);
+    ++pos;
+    ++count;
+  }
+
+  atomic_store_explicit(&ring.tail, pos, memory_order_relaxed);
+
+  size_t dropped = atomic_load_explicit(&ring.dropped, memory_order_relaxed);
+
+  if (dropped != ring.reported_drops) {
+    log_format_time(time(NULL), time_buf, sizeof(time_buf));
+    fprintf(writer.file, "WARN [%s] log ring full, %zu message(s) dropped\n",
+      time_buf, dropped - ring.reported_drops);
+    ring.reported_drops = dropped;
+    ++count;
+  }
+
+  return count;
+}
+
+/*
+  --- BINARY MODE ---
+
+  Every thread writes into its own single-producer byte ring, so the
+  hot path needs neither a lock nor a CAS. The buffers are registered in
+  a lock-free list on first use and belong to the writer thread from then
+  on; they are freed by `log_shutdown()`. A thread's `generation` tells
+  it whether its buffer is from a previous `log_init_binary()`.
+
+  Argument types are looked up in a small per-thread cache keyed by the
+  format string, so each format string is only parsed once per thread.
+
+*/
+
+typedef struct log_tbuf {
+  unsigned char* data;
+  size_t mask;
+  uint32_t thread_id;
+  struct log_tbuf* next;
+  size_t reported_drops;
+  alignas(CACHE_LINE_SIZE) atomic_size_t head;
+  atomic_size_t dropped;
+  alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+} log_tbuf_t;
+
+typedef struct log_sig {
+  const char* format;
+  uint8_t num_args;
+  uint8_t kinds[LOG_BIN_MAX_ARGS];
+} log_sig_t;
+
+static struct {
+  size_t capacity;
+  _Atomic(log_tbuf_t*) tbufs;
+  atomic_uint next_thread_id;
+  atomic_size_t generation;
+  uint64_t* seen;
+  size_t seen_cap;
+  size_t seen_count;
+} bin;
+
+static THREAD_LOCAL log_tbuf_t* thread_buf;
+static THREAD_LOCAL size_t thread_generation;
+static THREAD_LOCAL log_sig_t sig_cache[LOG_BIN_SIG_CACHE];
+
+static log_tbuf_t* tbuf_get(void)
+{
+  size_t generation = atomic_load_explicit(&bin.generation, memory_order_acquire);
+
+  if (thread_buf && thread_generation == generation)
+    return thread_buf;
+
+  log_tbuf_t* b = (log_tbuf_t*)calloc(1, sizeof(log_tbuf_t));
+  unsigned char* data = (unsigned char*)malloc(bin.capacity);
+
+  if (!b || !data) {
+    free(b);
+    free(data);
+    return NULL;
+  }
+
+  b->data = data;
+  b->mask = bin.capacity - 1;
+  b->thread_id = atomic_fetch_add(&bin.next_thread_id, 1);
+
+  log_tbuf_t* first = atomic_load(&bin.tbufs);
+
+  do {
+    b->next = first;
+  } while (!atomic_compare_exchange_weak(&bin.tbufs, &first, b));
+
+  thread_buf = b;
+  thread_generation = generation;
+  return b;
+}
+
+static void tbuf_copy_in(log_tbuf_t* b, size_t pos, const void* src, size_t size)
+{
+  size_t offset = pos & b->mask;
+  size_t first = b->mask + 1 - offset;
+
+  if (first > size)
+    first = size;
+
+  memcpy(b->data + offset, src, first);
+  memcpy(b->data, (const unsigned char*)src + first, size - first);
+}
+
+static void tbuf_copy_out(log_tbuf_t* b, size_t pos, void* dst, size_t size)
+{
+  size_t offset = pos & b->mask;
+  size_t first = b->mask + 1 - offset;
+
+  if (first > size)
+    first = size;
+
+  memcpy(dst, b->data + offset, first);
+  memcpy((unsigned char*)dst + first, b->data, size - first);
+}
+
+static const log_sig_t* sig_get(const char* format)
+{
+  log_sig_t* sig = &sig_cache[((uintptr_t)format >> 3) & (LOG_BIN_SIG_CACHE - 1)];
+
+  if (sig->format == format)
+    return sig;
+
+  log_spec_t spec;
+  const char* p = format;
+  uint8_t n = 0;
+
+  while (log_next_spec(&p, &spec) && n < LOG_BIN_MAX_ARGS) {
+    if (spec.width_star)
+      sig->kinds[n++] = LOG_ARG_INT;
+
+    if (spec.prec_star && n < LOG_BIN_MAX_ARGS)
+      sig->kinds[n++] = LOG_ARG_INT;
+
+    if (spec.kind != LOG_ARG_NONE && n < LOG_BIN_MAX_ARGS)
+      sig->kinds[n++] = (uint8_t)spec.kind;
+  }
+
+  sig->format = format;
+  sig->num_args = n;
+  return sig;
+}
+
+static size_t encode_args(unsigned char* out, size_t size, const log_sig_t* sig, va_list args)
+{
+  size_t pos = 0;
+
+  for (uint8_t i = 0; i < sig->num_args; ++i) {
+    uint64_t value = 0;
+
+    switch ((log_arg_kind)sig->kinds[i]) {
+      case LOG_ARG_INT:     value = (uint64_t)va_arg(args, int); break;
+      case LOG_ARG_UINT:    value = va_arg(args, unsigned int); break;
+      case LOG_ARG_LONG:    value = (uint64_t)va_arg(args, long); break;
+      case LOG_ARG_ULONG:   value = va_arg(args, unsigned long); break;
+      case LOG_ARG_LLONG:   value = (uint64_t)va_arg(args, long long); break;
+      case LOG_ARG_ULLONG:  value = va_arg(args, unsigned long long); break;
+      case LOG_ARG_SIZE:    value = va_arg(args, size_t); break;
+      case LOG_ARG_INTMAX:  value = (uint64_t)va_arg(args, intmax_t); break;
+      case LOG_ARG_UINTMAX: value = (uint64_t)va_arg(args, uintmax_t); break;
+      case LOG_ARG_PTRDIFF: value = (uint64_t)va_arg(args, ptrdiff_t); break;
+      case LOG_ARG_PTR:     value = (uint64_t)(uintptr_t)va_arg(args, void*); break;
+
+      case LOG_ARG_DOUBLE: {
+        double d = va_arg(args, double);
+        memcpy(&value, &d, sizeof(d));
+        break;
+      }
+
+      case LOG_ARG_LDOUBLE: {
+        double d = (double)va_arg(args, long double);
+        memcpy(&value, &d, sizeof(d));
+        break;
+      }
+
+      case LOG_ARG_STR: {
+        const char* str = va_arg(args, const char*);
+
+        if (!str)
+          str = "(null)";
+
+        size_t len = strlen(str);
+
+        if (pos + sizeof(uint32_t) > size)
+          return pos;
+
+        if (len > size - pos - sizeof(uint32_t))
+          len = size - pos - sizeof(uint32_t);
+
+        uint32_t len32 = (uint32_t)len;
+        memcpy(out + pos, &len32, sizeof(len32));
+        memcpy(out + pos + sizeof(len32), str, len);
+        pos += sizeof(len32) + len;
+        continue;
+      }
+
+      case LOG_ARG_SKIP:
+        va_arg(args, void*);
+        continue;
+
+      case LOG_ARG_NONE:
+      case LOG_ARG_NUM_KINDS:
+      default:
+        continue;
+    }
+
+    if (pos + sizeof(value) > size)
+      return pos;
+
+    memcpy(out + pos, &value, sizeof(value));
+    pos += sizeof(value);
+  }
+
+  return pos;
+}
+
+static bool tbuf_push(log_type type, const char* format, va_list args)
+{
+  log_tbuf_t* b = tbuf_get();
+
+  if (!b)
+    return false;
+
+  unsigned char record[LOG_BIN_RECORD_SIZE];
+  log_bin_hdr_t hdr = { 0 };
+  size_t payload = encode_args(record + sizeof(hdr), sizeof(record) - sizeof(hdr),
+    sig_get(format), args);
+
+  hdr.tag = 'M';
+  hdr.type = (uint8_t)type;
+  hdr.size = (uint32_t)payload;
+  hdr.id = (uint64_t)(uintptr_t)format;
+  hdr.time_ns = now_ns();
+  memcpy(record, &hdr, sizeof(hdr));
+
+  size_t size = sizeof(hdr) + payload;
+  size_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+
+  while (head + size - atomic_load_explicit(&b->tail, memory_order_acquire) > b->mask + 1) {
+    if (writer.policy == LOG_OVERFLOW_DROP)
+      return false;
+
+    if (writer.policy == LOG_OVERFLOW_COUNT) {
+      atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+
+    thrd_yield();
+  }
+
+  tbuf_copy_in(b, head, record, size);
+  atomic_store_explicit(&b->head, head + size, memory_order_release);
+
+  return true;
+}
+
+static void write_record(uint8_t tag, uint64_t id, const void* payload, size_t size)
+{
+  log_bin_hdr_t hdr = { 0 };
+  hdr.tag = tag;
+  hdr.size = (uint32_t)size;
+  hdr.id = id;
+  hdr.time_ns = now_ns();
+
+  fwrite(&hdr, sizeof(hdr), 1, writer.file);
+
+  if (size > 0)
+    fwrite(payload, size, 1, writer.file);
+}
+
+/// Returns true if the format string `id` was already written to the file, registers it otherwise.
+static bool seen_check(uint64_t id)
+{
+  if (bin.seen_count * 2 >= bin.seen_cap) {
+    size_t new_cap = bin.seen_cap ? bin.seen_cap * 2 : 256;
+    uint64_t* new_seen = (uint64_t*)calloc(new_cap, sizeof(uint64_t));
+
+    if (!new_seen)
+      return false;
+
+    for (size_t i = 0; i < bin.seen_cap; ++i) {
+      if (!bin.seen[i])
+        continue;
+
+      size_t j = (size_t)(bin.seen[i] >> 3) & (new_cap - 1);
+
+      while (new_seen[j])
+        j = (j + 1) & (new_cap - 1);
+
+      new_seen[j] = bin.seen[i];
+    }
+
+    free(bin.seen);
+    bin.seen = new_seen;
+    bin.seen_cap = new_cap;
+  }
+
+  size_t i = (size_t)(id >> 3) & (bin.seen_cap - 1);
+
+  while (bin.seen[i]) {
+    if (bin.seen[i] == id)
+      return true;
+
+    i = (i + 1) & (bin.seen_cap - 1);
+  }
+
+  bin.seen[i] = id;
+  ++bin.seen_count;
+  return false;
+}
+
+/// Moves all published records of one thread to the file and returns their number.
+static size_t tbuf_drain(log_tbuf_t* b)
+{
+  unsigned char record[LOG_BIN_RECORD_SIZE];
+  size_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&b->head, memory_order_acquire);
+  size_t dropped = atomic_load_explicit(&b->dropped, memory_order_relaxed);
+  size_t count = 0;
+
+  if (tail != head || dropped != b->reported_drops)
+    write_record('T', b->thread_id, NULL, 0);
+
+  while (tail != head) {
+    log_bin_hdr_t hdr;
+    tbuf_copy_out(b, tail, &hdr, sizeof(hdr));
+    tbuf_copy_out(b, tail + sizeof(hdr), record, hdr.size);
+
+    if (!seen_check(hdr.id)) {
+      const char* format = (const char*)(uintptr_t)hdr.id;
+      write_record('S', hdr.id, format, strlen(format));
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, writer.file);
+    fwrite(record, hdr.size, 1, writer.file);
+
+    tail += sizeof(hdr) + hdr.size;
+    ++count;
+  }
+
+  atomic_store_explicit(&b->tail, tail, memory_order_release);
+
+  if (dropped != b->reported_drops) {
+    write_record('D', dropped - b->reported_drops, NULL, 0);
+    b->reported_drops = dropped;
+    ++count;
+  }
+
+  return count;
+}
+
+static size_t bin_drain(void)
+{
+  size_t count = 0;
+
+  for (log_tbuf_t* b = atomic_load(&bin.tbufs); b; b = b->next)
+    count += tbuf_drain(b);
+
+  return count;
+}
+
+static void bin_free(void)
+{
+  log_tbuf_t* b = atomic_exchange(&bin.tbufs, NULL);
+
+  while (b) {
+    log_tbuf_t* next = b->next;
+    free(b->data);
+    free(b);
+    b = next;
+  }
+
+  free(bin.seen);
+  bin.seen = NULL;
+  bin.seen_cap = 0;
+  bin.seen_count = 0;
+}
+
+static int writer_main(void* arg)
+{
+  struct timespec idle = { 0, LOG_WRITER_IDLE_NS };
+  bool binary = writer.binary;
+
+  for (;;) {
+    bool running = atomic_load(&writer.running);
+    size_t req = atomic_load(&writer.flush_req);
+    size_t count = binary ? bin_drain() : ring_drain();
+
+    if (count > 0)
+      fflush(writer.file);
+
+    atomic_store(&writer.flush_done, req);
+
+    if (!running)
       break;
+
+    if (count == 0)
+      thrd_sleep(&idle, NULL);
+  }
+
+  return 0;
+}
+
+static bool writer_start(log_mode mode, const char* path, const char* file_mode)
+{
+  dir_ensure(LOG_DIR);
+  writer.file = fopen(path, file_mode);
+
+  if (!writer.file)
+    return false;
+
+  writer.binary = mode == LOG_MODE_BINARY;
+  atomic_store(&writer.flush_done, atomic_load(&writer.flush_req));
+  atomic_store(&writer.mode, mode);
+  atomic_store(&writer.running, true);
+
+  if (thrd_create(&writer.thread, writer_main, NULL) != thrd_success) {
+    atomic_store(&writer.mode, LOG_MODE_SYNC);
+    fclose(writer.file);
+    return false;
+  }
+
+  return true;
+}
+
+bool log_init_async(size_t capacity, log_overflow policy)
+{
+  if (atomic_load(&writer.mode) != LOG_MODE_SYNC)
+    return false;
+
+  size_t cap = 2;
+
+  while (cap < capacity)
+    cap <<= 1;
+
+  if (log_file[0] == '\0')
+    store_startup_time();
+
+  log_slot_t* slots = (log_slot_t*)malloc(cap * sizeof(log_slot_t));
+
+  if (!slots)
+    return false;
+
+  for (size_t i = 0; i < cap; ++i)
+    atomic_init(&slots[i].seq, i);
+
+  ring.slots = slots;
+  ring.mask = cap - 1;
+  ring.reported_drops = 0;
+  atomic_store(&ring.head, 0);
+  atomic_store(&ring.tail, 0);
+  atomic_store(&ring.dropped, 0);
+  writer.policy = policy;
+
+  if (!writer_start(LOG_MODE_ASYNC, log_file, "a")) {
+    free(slots);
+    ring.slots = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+bool log_init_binary(size_t thread_capacity, log_overflow policy)
+{
+  if (atomic_load(&writer.mode) != LOG_MODE_SYNC)
+    return false;
+
+  size_t cap = LOG_BIN_RECORD_SIZE;
+
+  while (cap < thread_capacity)
+    cap <<= 1;
+
+  if (log_file[0] == '\0')
+    store_startup_time();
+
+  char path[sizeof(log_file) + 8];
+  snprintf(path, sizeof(path), "%s", log_file);
+  char* ext = strrchr(path, '.');
+  snprintf(ext ? ext : path + strlen(path), 8, ".blog");
+
+  bin.capacity = cap;
+  atomic_fetch_add(&bin.generation, 1);
+  writer.policy = policy;
+
+  // The header goes in before the writer thread starts.
+  dir_ensure(LOG_DIR);
+  FILE* file = fopen(path, "ab");
+
+  if (!file)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+
+  if (ftell(file) == 0) {
+    log_bin_file_t file_hdr = { LOG_BIN_MAGIC, LOG_BIN_VERSION,
+      (uint8_t)sizeof(long), (uint8_t)sizeof(void*), 0 };
+    fwrite(&file_hdr, sizeof(file_hdr), 1, file);
+  }
+
+  // Format string ids are addresses, which another run may reuse for other strings.
+  log_bin_hdr_t session = { 0 };
+  session.tag = 'N';
+  session.time_ns = now_ns();
+  fwrite(&session, sizeof(session), 1, file);
+
+  fclose(file);
+
+  return writer_start(LOG_MODE_BINARY, path, "ab");
+}
+
+void log_flush(void)
+{
+  if (atomic_load(&writer.mode) == LOG_MODE_SYNC)
+    return;
+
+  size_t req = atomic_fetch_add(&writer.flush_req, 1) + 1;
+
+  while (atomic_load(&writer.flush_done) < req)
+    thrd_yield();
+}
+
+void log_shutdown(void)
+{
+  int mode = atomic_exchange(&writer.mode, LOG_MODE_SYNC);
+
+  if (mode == LOG_MODE_SYNC)
+    return;
+
+  // Producers that saw the old mode finish their message first.
+  while (atomic_load(&writer.producers) > 0)
+    thrd_yield();
+
+  atomic_store(&writer.running, false);
+  thrd_join(writer.thread, NULL);
+  atomic_store(&writer.flush_done, SIZE_MAX);
+
+  fclose(writer.file);
+  writer.file = NULL;
+
+  if (mode == LOG_MODE_BINARY)
+    bin_free();
+
+  else {
+    free(ring.slots);
+    ring.slots = NULL;
   }
+}
+
+size_t log_dropped(void)
+{
+  size_t dropped = atomic_load_explicit(&ring.dropped, memory_order_relaxed);
+
+  for (log_tbuf_t* b = atomic_load(&bin.tbufs); b; b = b->next)
+    dropped += atomic_load_explicit(&b->dropped, memory_order_relaxed);
+
+  return dropped;
+}
+
+void flog(log_type type, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+
+  atomic_fetch_add(&writer.producers, 1);
+  int mode = atomic_load(&writer.mode);
+
+  if (mode != LOG_MODE_SYNC) {
+    if (mode == LOG_MODE_BINARY)
+      tbuf_push(type, format, args);
+    else
+      ring_push(type, format, args);
+
+    atomic_fetch_sub(&writer.producers, 1);
+    va_end(args);
+    return;
+  }
+
+  atomic_fetch_sub(&writer.producers, 1);
+
+  // Prefix and message go into the same buffer, so the message is only formatted once.
+  char typed_msg[LOG_LINE_SIZE];
+  char time_buf[32];
+  log_format_time(time(NULL), time_buf, sizeof(time_buf));
+
+  int prefix = snprintf(typed_msg, sizeof(typed_msg),
+    type >= LOG_NUM_TYPES ? "%s%s]\t" : "%s%s] ", type_prefix(type), time_buf);
+  size_t len = (size_t)prefix;
+  int written = vsnprintf(typed_msg + len, LOG_MSG_SIZE, format, args);
+
+  va_end(args);
+
+  len += written < 0 ? 0 : (size_t)written >= LOG_MSG_SIZE ? LOG_MSG_SIZE - 1 : (size_t)written;
+  typed_msg[len++] = '\n';
+  typed_msg[len] = '\0';
 
-  dir_ensure("base_logs");
+  dir_ensure(LOG_DIR);
   file_write(log_file, typed_msg);
 }
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 typedef enum {
   LOG_INFO,
@@ -9,6 +13,127 @@ typedef enum {
   LOG_NUM_TYPES
 } log_type;
 
+/// @brief Decides what happens to a message in asynchronous or binary mode
+/// when the buffer it goes to is full.
+typedef enum {
+  LOG_OVERFLOW_DROP,  // Silently discard the message.
+  LOG_OVERFLOW_BLOCK, // Wait until the writer thread has made room.
+  LOG_OVERFLOW_COUNT, // Discard the message, but report the number of drops in the log.
+  LOG_OVERFLOW_NUM_POLICIES
+} log_overflow;
+
+/// @brief Returns the current time as a string. The buffer is thread-local.
 const char* current_time(void);
 void store_startup_time(void);
 void flog(log_type type, const char* format, ...);
+
+/// @brief Switches `flog()` to asynchronous mode. Messages are formatted
+/// into a lock-free ring buffer of `capacity` slots (rounded up to a power of 2),
+/// and a background thread writes them in batches to the log file, which is
+/// kept open until `log_shutdown()`.
+/// @return False if the log file or the writer thread couldn't be created,
+/// in which case `flog()` stays synchronous.
+bool log_init_async(size_t capacity, log_overflow policy);
+
+/// @brief Switches `flog()` to binary mode. Each thread gets its own lock-free
+/// buffer of `thread_capacity` bytes (rounded up to a power of 2), into which
+/// `flog()` writes the address of the format string, a timestamp and the raw
+/// arguments, without formatting anything. A background thread moves the records
+/// to a `.blog` file next to the text log, which `log_decode` turns into text.
+/// Format strings have to outlive the logger (string literals always do).
+/// @return False if the log file or the writer thread couldn't be created,
+/// in which case `flog()` stays synchronous.
+bool log_init_binary(size_t thread_capacity, log_overflow policy);
+
+/// @brief Blocks until every message logged before this call is written to disk.
+/// Does nothing in synchronous mode.
+void log_flush(void);
+
+/// @brief Writes all pending messages, stops the writer thread, closes the
+/// log file and switches `flog()` back to synchronous mode.
+void log_shutdown(void);
+
+/// @brief Returns the number of messages dropped under the `LOG_OVERFLOW_COUNT`
+/// policy since `log_init_async()` or `log_init_binary()`.
+size_t log_dropped(void);
+
+/*
+  --- BINARY LOG FORMAT ---
+
+  A `.blog` file starts with a `log_bin_file_t`, followed by records that
+  each begin with a `log_bin_hdr_t` and `size` bytes of payload:
+
+  'S' - format string `id`, payload is the string itself. Written once per
+        string, before the first message that uses it.
+  'T' - all following messages come from thread `id`.
+  'M' - message of type `type` using format string `id`, payload holds the
+        arguments: 8 bytes per number or pointer, strings as a 4 byte length
+        followed by the characters.
+  'D' - `id` messages of the current thread were dropped.
+  'N' - a new session: `log_init_binary()` was called again, possibly by another
+        program, and the format strings and threads seen so far don't apply anymore.
+        Starts every session since version 2.
+
+*/
+
+#define LOG_BIN_MAGIC "BLOG"
+#define LOG_BIN_VERSION 2
+
+typedef struct log_bin_file {
+  char magic[4];
+  uint8_t version;
+  uint8_t long_size;
+  uint8_t ptr_size;
+  uint8_t reserved;
+} log_bin_file_t;
+
+typedef struct log_bin_hdr {
+  uint8_t tag;
+  uint8_t type;
+  uint16_t reserved;
+  uint32_t size;
+  uint64_t id;
+  int64_t time_ns;
+} log_bin_hdr_t;
+
+typedef enum {
+  LOG_ARG_NONE,
+  LOG_ARG_INT,
+  LOG_ARG_UINT,
+  LOG_ARG_LONG,
+  LOG_ARG_ULONG,
+  LOG_ARG_LLONG,
+  LOG_ARG_ULLONG,
+  LOG_ARG_SIZE,
+  LOG_ARG_INTMAX,
+  LOG_ARG_UINTMAX,
+  LOG_ARG_PTRDIFF,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_LDOUBLE,
+  LOG_ARG_STR,
+  LOG_ARG_PTR,
+  LOG_ARG_SKIP,
+  LOG_ARG_NUM_KINDS
+} log_arg_kind;
+
+typedef struct log_spec {
+  const char* start;
+  size_t len;
+  bool width_star;
+  bool prec_star;
+  log_arg_kind kind;
+} log_spec_t;
+
+/// @brief ---INTERNAL FUNCTION---
+/// Finds the next conversion specification in `*format` and advances
+/// `*format` past it.
+/// @return False if there is none left.
+bool log_next_spec(const char** format, log_spec_t* spec);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Formats a time as it appears in the log.
+void log_format_time(time_t t, char* buf, size_t size);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Formats a complete log line, including type, time and trailing newline.
+void log_format_line(char* line, size_t size, log_type type, const char* timestamp, const char* msg);
@@ -12,33 +12,32 @@ bool within_bounds(void* ptr, unsigned char* buf, size_t buf_size)
   return (uptr > ubuf && uptr < uend);
 }
 
-uintptr_t align_ptr(uintptr_t ptr, uintptr_t align)
+void align_error(const char* func)
 {
-  if (!is_pow2(align)) {
-    flog(LOG_ERROR, "align_ptr(): Given pointer alignment no power of 2");
-    exit(EXIT_FAILURE);
-  }
-
-  uintptr_t mod = ptr & (align - 1);
-
-  if (mod != 0)
-    ptr += align - mod;
-
-  return ptr;
+  flog(LOG_ERROR, "%s(): Given alignment no power of 2", func);
+  exit(EXIT_FAILURE);
 }
 
-uintptr_t align_size(size_t size, uintptr_t align)
+void* aligned_malloc(size_t size, size_t align)
 {
-  if (!is_pow2(align)) {
-    flog(LOG_ERROR, "align_size(): Given alignment no power of 2");
-    exit(EXIT_FAILURE);
-  }
+  ALIGN_CHECK(align, "aligned_malloc");
 
-  uintptr_t size_ptr = (uintptr_t)size;
-  uintptr_t mod = size_ptr & (align - 1);
+  if (align < sizeof(void*))
+    align = sizeof(void*);
 
-  if (mod != 0)
-    size_ptr += align - mod;
+#ifdef _MSC_VER
+  return _aligned_malloc(size, align);
+#else
+  // aligned_alloc() wants the size to be a multiple of the alignment.
+  return aligned_alloc(align, (size_t)align_size(size, align));
+#endif
+}
 
-  return size_ptr;
+void aligned_free(void* ptr)
+{
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
 }
@@ -1,14 +1,21 @@
 #pragma once
 
+#include <assert.h>
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "base/config.h"
 #include "base/log.h"
 
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
 #ifndef DEFAULT_ALIGN
   #if __STDC_VERSION__ >= 201112L
     #define DEFAULT_ALIGN alignof(max_align_t)
@@ -17,14 +24,62 @@
   #endif
 #endif
 
+#ifndef CACHE_LINE_SIZE
+  #define CACHE_LINE_SIZE 64
+#endif
+
+// Byte that uninitialized allocations are filled with in `BASE_DEBUG` builds.
+#ifndef MEM_POISON_BYTE
+  #define MEM_POISON_BYTE 0xCD
+#endif
+
+// Byte that the red zone behind each block is filled with in `BASE_DEBUG` builds.
+#ifndef MEM_CANARY_BYTE
+  #define MEM_CANARY_BYTE 0xFD
+#endif
+
+// Bytes that each block of the arena, stack, free list and TLSF allocators grows by
+// in `BASE_DEBUG` builds: a red zone of at least `MEM_REDZONE_SIZE` canary bytes,
+// followed by the requested size.
+#ifdef BASE_DEBUG
+  #ifndef MEM_REDZONE_SIZE
+    #define MEM_REDZONE_SIZE 16
+  #endif
+
+  #define MEM_TRAILER_SIZE (MEM_REDZONE_SIZE + sizeof(size_t))
+#else
+  #define MEM_TRAILER_SIZE 0
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+  #define MEM_ASAN
+#elif defined(__has_feature)
+  #if __has_feature(address_sanitizer)
+    #define MEM_ASAN
+  #endif
+#endif
+
+#if defined(BASE_DEBUG) && defined(MEM_ASAN)
+  #include <sanitizer/asan_interface.h>
+#endif
+
+#ifdef _MSC_VER
+  #define THREAD_LOCAL __declspec(thread)
+#else
+  #define THREAD_LOCAL _Thread_local
+#endif
+
 #define VALUE(value, ...) value
 #define SELECT_VALIDATION(_1, _2, validation, ...) validation
 
 /// @brief Takes a pointer and optionally a value.
 /// Returns the function if the pointer is null, returns the value if it was given, void if not.
-#define VALIDATE_PTR(...) SELECT_VALIDATION(__VA_ARGS__, VALIDATE_PTR_VAL, VALIDATE_PTR_VOID)(__VA_ARGS__)
+/// Unlike `VALIDATE_PTR()`, it stays in `BASE_FAST` builds, so it's meant for pointers
+/// that can be null at runtime (e.g. a failed allocation) rather than by mistake, and for
+/// the pointers given to the `_free()` functions, which treat null like `free()` does.
+#define CHECK_PTR(...) SELECT_VALIDATION(__VA_ARGS__, CHECK_PTR_VAL, CHECK_PTR_VOID)(__VA_ARGS__)
 
-#define VALIDATE_PTR_VAL(ptr, ...)\
+#define CHECK_PTR_VAL(ptr, ...)\
 do {\
   if (!ptr) {\
     flog(LOG_WARNING, "%s(): %s invalid", __func__, #ptr);\
@@ -32,7 +87,7 @@ do {\
   }\
 } while(0);
 
-#define VALIDATE_PTR_VOID(ptr, ...)\
+#define CHECK_PTR_VOID(ptr, ...)\
 do {\
   if (!ptr) {\
     flog(LOG_WARNING, "%s(): %s invalid", __func__, #ptr);\
@@ -40,26 +95,190 @@ do {\
   }\
 } while (0);
 
+/// @brief Takes a pointer and optionally a value, see `CHECK_PTR()`. Used for the arguments
+/// of functions. `BASE_FAST` builds turn it into an `assert()`, which `NDEBUG` removes.
+#ifdef BASE_FAST
+  #define VALIDATE_PTR(...) assert(VALUE(__VA_ARGS__, 0))
+#else
+  #define VALIDATE_PTR(...) CHECK_PTR(__VA_ARGS__)
+#endif
+
+/// @brief ---INTERNAL FUNCTION---
+/// Logs that `func` was given an alignment that is no power of 2 and exits.
+void align_error(const char* func);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Checks that an alignment is a power of 2. An `assert()` in `BASE_FAST` builds.
+/// For a constant alignment, the check folds away when optimizing.
+#ifdef BASE_FAST
+  #define ALIGN_CHECK(align, func) assert(is_pow2(align))
+#else
+  #define ALIGN_CHECK(align, func)\
+  do {\
+    if (!is_pow2(align))\
+      align_error(func);\
+  } while (0)
+#endif
+
+/// @brief ---INTERNAL FUNCTION---
+/// Checks if a given memory address is a power of 2.
+static inline bool is_pow2(uintptr_t p)
+{
+  uintptr_t mod = p & (p - 1);
+  return mod == 0; 
+}
+
 /// @brief ---INTERNAL FUNCTION---
 /// Aligns a given pointer according to the given alignment size.
 /// Will crash if the alignment is not a power of 2.
 /// @return The aligned pointer.
-uintptr_t align_ptr(uintptr_t ptr, uintptr_t align);
+static inline uintptr_t align_ptr(uintptr_t ptr, uintptr_t align)
+{
+  ALIGN_CHECK(align, "align_ptr");
+  return (ptr + (align - 1)) & ~(align - 1);
+}
 
 /// @brief ---INTERNAL FUNCTION---
 /// Aligns a given size (usually a buffer size) according to 
 /// the given alignment.
 /// @return The aligned size as uintptr_t.
-uintptr_t align_size(size_t size, uintptr_t align);
+static inline uintptr_t align_size(size_t size, uintptr_t align)
+{
+  ALIGN_CHECK(align, "align_size");
+  return ((uintptr_t)size + (align - 1)) & ~(align - 1);
+}
 
 /// @brief ---INTERNAL FUNCTION---
-/// Checks if a given memory address is a power of 2.
-static inline bool is_pow2(uintptr_t p)
+/// Fills memory that is handed out uninitialized with `MEM_POISON_BYTE`,
+/// so reads before the first write stand out. Does nothing unless
+/// `BASE_DEBUG` is defined.
+/// @return The given pointer.
+static inline void* mem_poison(void* ptr, size_t size)
 {
-  uintptr_t mod = p & (p - 1);
-  return mod == 0; 
+#ifdef BASE_DEBUG
+  return memset(ptr, MEM_POISON_BYTE, size);
+#else
+  (void)size;
+  return ptr;
+#endif
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Marks a block for AddressSanitizer as inaccessible (`MEM_ASAN_POISON`) or accessible
+/// (`MEM_ASAN_UNPOISON`) again. The allocators poison memory while it's free.
+/// Only active in `BASE_DEBUG` builds compiled with `-fsanitize=address`; a buffer that
+/// was handed to an allocator should be unpoisoned before it's used for anything else.
+#if defined(BASE_DEBUG) && defined(MEM_ASAN)
+  #define MEM_ASAN_POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+  #define MEM_ASAN_UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+  #define MEM_ASAN_POISON(ptr, size) ((void)sizeof(ptr), (void)sizeof(size))
+  #define MEM_ASAN_UNPOISON(ptr, size) ((void)sizeof(ptr), (void)sizeof(size))
+#endif
+
+/// @brief ---INTERNAL FUNCTION---
+/// Fills the end of a block of `block_size` bytes, from byte `size` on, with
+/// `MEM_CANARY_BYTE` and stores `size` in its last bytes, so that `mem_canary_check()`
+/// finds writes past the end of the requested memory. The block has to have room
+/// for `MEM_TRAILER_SIZE` bytes after `size`. Does nothing unless `BASE_DEBUG` is defined.
+static inline void mem_canary_set(void* ptr, size_t size, size_t block_size)
+{
+#ifdef BASE_DEBUG
+  unsigned char* block = (unsigned char*)ptr;
+  size_t trailer = block_size - sizeof(size_t);
+
+  MEM_ASAN_UNPOISON(block, block_size);
+  memset(block + size, MEM_CANARY_BYTE, trailer - size);
+  memcpy(block + trailer, &size, sizeof(size_t));
+  MEM_ASAN_POISON(block + size, block_size - size);
+#else
+  (void)ptr;
+  (void)size;
+  (void)block_size;
+#endif
 }
 
+/// @brief ---INTERNAL FUNCTION---
+/// Checks the canary that `mem_canary_set()` placed at the end of a block of
+/// `block_size` bytes and terminates the program if it was overwritten.
+/// Does nothing unless `BASE_DEBUG` is defined.
+/// @return The size stored with the canary, 0 without `BASE_DEBUG`.
+static inline size_t mem_canary_check(void* ptr, size_t block_size, const char* func)
+{
+#ifdef BASE_DEBUG
+  unsigned char* block = (unsigned char*)ptr;
+  size_t trailer = block_size - sizeof(size_t);
+  size_t size = 0;
+  bool intact = block_size >= MEM_TRAILER_SIZE;
+
+  if (intact) {
+    MEM_ASAN_UNPOISON(block + trailer, sizeof(size_t));
+    memcpy(&size, block + trailer, sizeof(size_t));
+    intact = size <= block_size - MEM_TRAILER_SIZE;
+  }
+
+  if (intact) {
+    MEM_ASAN_UNPOISON(block + size, trailer - size);
+
+    for (size_t i = size; i < trailer && intact; ++i)
+      intact = block[i] == MEM_CANARY_BYTE;
+  }
+
+  if (!intact) {
+    flog(LOG_ERROR, "%s(): memory past the end of block %p was overwritten", func, ptr);
+    exit(EXIT_FAILURE);
+  }
+
+  return size;
+#else
+  (void)ptr;
+  (void)block_size;
+  (void)func;
+  return 0;
+#endif
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Returns the index of the lowest set bit. `x` must not be 0.
+static inline unsigned lowest_bit(uint64_t x)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, x);
+  return (unsigned)i;
+#else
+  return (unsigned)__builtin_ctzll(x);
+#endif
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Returns the index of the highest set bit. `x` must not be 0.
+static inline unsigned highest_bit(uint64_t x)
+{
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanReverse64(&i, x);
+  return (unsigned)i;
+#else
+  return 63u - (unsigned)__builtin_clzll(x);
+#endif
+}
+
+/// @brief ---INTERNAL FUNCTION---
+/// Rounds `x` up to the next power of 2. Returns 1 for 0.
+static inline uint64_t next_pow2(uint64_t x)
+{
+  return x > 1 ? (uint64_t)1 << (highest_bit(x - 1) + 1) : 1;
+}
+
+/// @brief Allocates a block of heap memory with the given alignment, which
+/// has to be a power of 2. Free it with `aligned_free()`.
+/// @return A pointer to the block, or null on failure.
+void* aligned_malloc(size_t size, size_t align);
+
+/// @brief Frees a block allocated with `aligned_malloc()`.
+void aligned_free(void* ptr);
+
 /// @brief ---INTERNAL FUNCTION--- 
 /// Checks if a given memory address is within a given buffer.
 bool within_bounds(void* ptr, unsigned char* buf, size_t buf_size);
@@ -0,0 +1,281 @@
+#include "base/queue.h"
+#include "base/log.h"
+
+void spsc_init(spsc_t* q, size_t capacity, allocator_t allocator)
+{
+  VALIDATE_PTR(q);
+
+  capacity = (size_t)next_pow2(capacity);
+  q->slots = (void**)allocator_alloc(&allocator, capacity * sizeof(void*), DEFAULT_ALIGN);
+
+  if (!q->slots) {
+    flog(LOG_ERROR, "spsc_init(): buffer allocation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  q->mask = capacity - 1;
+  q->allocator = allocator;
+  q->tail_cache = 0;
+  q->head_cache = 0;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+}
+
+void spsc_release(spsc_t* q)
+{
+  VALIDATE_PTR(q);
+  VALIDATE_PTR(q->slots);
+
+  allocator_free(&q->allocator, q->slots, (q->mask + 1) * sizeof(void*));
+  q->slots = NULL;
+}
+
+/// Returns how many items the producer can append, refreshing its copy
+/// of the consumer's index only if `wanted` don't fit.
+static inline size_t spsc_space(spsc_t* q, size_t tail, size_t wanted)
+{
+  size_t space = q->mask + 1 - (tail - q->head_cache);
+
+  if (space < wanted) {
+    q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+    space = q->mask + 1 - (tail - q->head_cache);
+  }
+
+  return space;
+}
+
+/// Returns how many items the consumer can remove, refreshing its copy
+/// of the producer's index only if fewer than `wanted` are known.
+static inline size_t spsc_avail(spsc_t* q, size_t head, size_t wanted)
+{
+  size_t avail = q->tail_cache - head;
+
+  if (avail < wanted) {
+    q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+    avail = q->tail_cache - head;
+  }
+
+  return avail;
+}
+
+bool spsc_push(spsc_t* q, void* item)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  if (spsc_space(q, tail, 1) == 0)
+    return false;
+
+  q->slots[tail & q->mask] = item;
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+  return true;
+}
+
+bool spsc_pop(spsc_t* q, void** item)
+{
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  if (spsc_avail(q, head, 1) == 0)
+    return false;
+
+  *item = q->slots[head & q->mask];
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+  return true;
+}
+
+size_t spsc_push_n(spsc_t* q, void** items, size_t n)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t space = spsc_space(q, tail, n);
+  size_t count = n < space ? n : space;
+
+  for (size_t i = 0; i < count; ++i)
+    q->slots[(tail + i) & q->mask] = items[i];
+
+  if (count > 0)
+    atomic_store_explicit(&q->tail, tail + count, memory_order_release);
+
+  return count;
+}
+
+size_t spsc_pop_n(spsc_t* q, void** items, size_t n)
+{
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t avail = spsc_avail(q, head, n);
+  size_t count = n < avail ? n : avail;
+
+  for (size_t i = 0; i < count; ++i)
+    items[i] = q->slots[(head + i) & q->mask];
+
+  if (count > 0)
+    atomic_store_explicit(&q->head, head + count, memory_order_release);
+
+  return count;
+}
+
+void mpmc_init(mpmc_t* q, size_t capacity, allocator_t allocator)
+{
+  VALIDATE_PTR(q);
+
+  // A single cell can't tell an item written at a position from the cell being
+  // free for the next one, both have the sequence number of the next position.
+  capacity = capacity < 2 ? 2 : (size_t)next_pow2(capacity);
+  q->cells = (mpmc_cell_t*)allocator_alloc(&allocator, capacity * sizeof(mpmc_cell_t), DEFAULT_ALIGN);
+
+  if (!q->cells) {
+    flog(LOG_ERROR, "mpmc_init(): buffer allocation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < capacity; ++i)
+    atomic_init(&q->cells[i].seq, i);
+
+  q->mask = capacity - 1;
+  q->allocator = allocator;
+  atomic_init(&q->enqueue_pos, 0);
+  atomic_init(&q->dequeue_pos, 0);
+}
+
+void mpmc_release(mpmc_t* q)
+{
+  VALIDATE_PTR(q);
+  VALIDATE_PTR(q->cells);
+
+  allocator_free(&q->allocator, q->cells, (q->mask + 1) * sizeof(mpmc_cell_t));
+  q->cells = NULL;
+}
+
+/// Returns the distance of a cell's sequence number to the one expected
+/// at `pos`: 0 if the cell is ready, negative if it lags a full round behind.
+static inline intptr_t mpmc_diff(mpmc_cell_t* cell, size_t expected)
+{
+  size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+  return (intptr_t)(seq - expected);
+}
+
+bool mpmc_push(mpmc_t* q, void* item)
+{
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  mpmc_cell_t* cell;
+
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    intptr_t diff = mpmc_diff(cell, pos);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+  }
+
+  cell->item = item;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+  return true;
+}
+
+bool mpmc_pop(mpmc_t* q, void** item)
+{
+  size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  mpmc_cell_t* cell;
+
+  for (;;) {
+    cell = &q->cells[pos & q->mask];
+    intptr_t diff = mpmc_diff(cell, pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+          memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+  }
+
+  *item = cell->item;
+  atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+
+  return true;
+}
+
+size_t mpmc_push_n(mpmc_t* q, void** items, size_t n)
+{
+  size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  size_t count;
+
+  if (n == 0)
+    return 0;
+
+  for (;;) {
+    count = 0;
+
+    while (count < n && mpmc_diff(&q->cells[(pos + count) & q->mask], pos + count) == 0)
+      ++count;
+
+    if (count == 0) {
+      if (mpmc_diff(&q->cells[pos & q->mask], pos) < 0)
+        return 0;
+
+      pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+      continue;
+    }
+
+    // Succeeds only if no other producer claimed `pos` meanwhile, in which
+    // case the cells checked above are still ready.
+    if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + count,
+        memory_order_relaxed, memory_order_relaxed))
+      break;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    mpmc_cell_t* cell = &q->cells[(pos + i) & q->mask];
+    cell->item = items[i];
+    atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);
+  }
+
+  return count;
+}
+
+size_t mpmc_pop_n(mpmc_t* q, void** items, size_t n)
+{
+  size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  size_t count;
+
+  if (n == 0)
+    return 0;
+
+  for (;;) {
+    count = 0;
+
+    while (count < n && mpmc_diff(&q->cells[(pos + count) & q->mask], pos + count + 1) == 0)
+      ++count;
+
+    if (count == 0) {
+      if (mpmc_diff(&q->cells[pos & q->mask], pos + 1) < 0)
+        return 0;
+
+      pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+      continue;
+    }
+
+    if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + count,
+        memory_order_relaxed, memory_order_relaxed))
+      break;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    mpmc_cell_t* cell = &q->cells[(pos + i) & q->mask];
+    items[i] = cell->item;
+    atomic_store_explicit(&cell->seq, pos + i + q->mask + 1, memory_order_release);
+  }
+
+  return count;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/allocators.h"
+#include "base/mem_utils.h"
+
+/*
+  --- BOUNDED QUEUES ---
+
+  Lock-free queues of pointers with a fixed capacity (rounded up to a
+  power of 2), meant for handing buffers such as pool slots from one thread
+  to another without allocating. Their storage comes from the allocator
+  given to the init function. Push and pop never block; they fail when
+  the queue is full or empty, respectively.
+
+  `spsc_t` allows one producer and one consumer thread. Each side keeps a
+  cached copy of the other side's index on its own cache line, so it only
+  reads the shared index when the cached one says the queue is full/empty.
+
+  `mpmc_t` allows any number of producers and consumers. It follows Dmitry
+  Vyukov's design: every cell carries a sequence number that tells whether
+  it is ready to be written or read at the current position, so producers
+  and consumers each only contend on their own cache-line padded position.
+  The batch functions claim a run of ready cells with a single CAS.
+
+*/
+
+typedef struct spsc {
+  void** slots;
+  size_t mask;
+  allocator_t allocator;
+  alignas(CACHE_LINE_SIZE) _Atomic(size_t) head;
+  size_t tail_cache;
+  alignas(CACHE_LINE_SIZE) _Atomic(size_t) tail;
+  size_t head_cache;
+} spsc_t;
+
+typedef struct mpmc_cell {
+  _Atomic(size_t) seq;
+  void* item;
+} mpmc_cell_t;
+
+typedef struct mpmc {
+  mpmc_cell_t* cells;
+  size_t mask;
+  allocator_t allocator;
+  alignas(CACHE_LINE_SIZE) _Atomic(size_t) enqueue_pos;
+  alignas(CACHE_LINE_SIZE) _Atomic(size_t) dequeue_pos;
+} mpmc_t;
+
+/// @brief Initializes a single-producer single-consumer queue of at least
+/// `capacity` pointers, whose storage comes from the given allocator.
+/// Not thread-safe itself.
+void spsc_init(spsc_t* q, size_t capacity, allocator_t allocator);
+
+/// @brief Frees the storage of the queue through its allocator.
+void spsc_release(spsc_t* q);
+
+/// @brief Appends an item. May only be called by the producer thread.
+/// @return False if the queue is full.
+bool spsc_push(spsc_t* q, void* item);
+
+/// @brief Removes the oldest item. May only be called by the consumer thread.
+/// @return False if the queue is empty.
+bool spsc_pop(spsc_t* q, void** item);
+
+/// @brief Appends up to `n` items at once. May only be called by the producer thread.
+/// @return The number of items appended.
+size_t spsc_push_n(spsc_t* q, void** items, size_t n);
+
+/// @brief Removes up to `n` of the oldest items at once. May only be called
+/// by the consumer thread.
+/// @return The number of items removed.
+size_t spsc_pop_n(spsc_t* q, void** items, size_t n);
+
+/// @brief Initializes a multi-producer multi-consumer queue of at least
+/// `capacity` pointers, whose storage comes from the given allocator.
+/// The capacity is at least 2. Not thread-safe itself.
+void mpmc_init(mpmc_t* q, size_t capacity, allocator_t allocator);
+
+/// @brief Frees the storage of the queue through its allocator.
+void mpmc_release(mpmc_t* q);
+
+/// @brief Appends an item. Thread-safe.
+/// @return False if the queue is full.
+bool mpmc_push(mpmc_t* q, void* item);
+
+/// @brief Removes the oldest item. Thread-safe.
+/// @return False if the queue is empty.
+bool mpmc_pop(mpmc_t* q, void** item);
+
+/// @brief Appends up to `n` items, which end up next to each other in the queue.
+/// Thread-safe.
+/// @return The number of items appended.
+size_t mpmc_push_n(mpmc_t* q, void** items, size_t n);
+
+/// @brief Removes up to `n` consecutive items. Thread-safe.
+/// @return The number of items removed.
+size_t mpmc_pop_n(mpmc_t* q, void** items, size_t n);
@@ -0,0 +1,178 @@
+#ifdef _MSC_VER
+  #define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#ifndef _WIN32
+  #define _DEFAULT_SOURCE
+#endif
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "base/log.h"
+#include "base/mem_utils.h"
+#include "base/trace.h"
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#endif
+
+typedef struct trace_buf {
+  size_t generation;
+  uint64_t seq;
+  uint32_t count;
+  uint16_t thread;
+  unsigned suspended;
+  trace_rec_t recs[TRACE_BUFFER_SIZE];
+} trace_buf_t;
+
+static struct {
+  mtx_t lock;
+  FILE* file;
+  int64_t start_ns;
+  atomic_bool active;
+  atomic_size_t generation;
+  atomic_uint threads;
+} tracer;
+
+static once_flag trace_once = ONCE_FLAG_INIT;
+static THREAD_LOCAL trace_buf_t trace_buf;
+
+static void trace_init(void)
+{
+  if (mtx_init(&tracer.lock, mtx_plain) != thrd_success) {
+    flog(LOG_ERROR, "trace_init(): mutex creation failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/// A monotonic clock, so that a step of the wall clock can't reorder the records of a thread.
+static int64_t trace_now_ns(void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+
+  if (!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+
+  QueryPerformanceCounter(&counter);
+  return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+#endif
+}
+
+/// Writes the records of the calling thread, if they belong to the running trace.
+static void trace_write(void)
+{
+  mtx_lock(&tracer.lock);
+
+  if (tracer.file && trace_buf.generation == atomic_load(&tracer.generation))
+    fwrite(trace_buf.recs, sizeof(trace_rec_t), trace_buf.count, tracer.file);
+
+  mtx_unlock(&tracer.lock);
+  trace_buf.count = 0;
+}
+
+bool trace_begin(const char* path)
+{
+  VALIDATE_PTR(path, false);
+
+  call_once(&trace_once, trace_init);
+  mtx_lock(&tracer.lock);
+
+  if (tracer.file) {
+    mtx_unlock(&tracer.lock);
+    flog(LOG_WARNING, "trace_begin(): a trace is already running");
+    return false;
+  }
+
+  tracer.file = fopen(path, "wb");
+
+  if (!tracer.file) {
+    mtx_unlock(&tracer.lock);
+    flog(LOG_WARNING, "trace_begin(): can't open %s", path);
+    return false;
+  }
+
+  trace_file_t hdr = { { 0 }, TRACE_VERSION };
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  fwrite(&hdr, sizeof(hdr), 1, tracer.file);
+
+  tracer.start_ns = trace_now_ns();
+  atomic_store(&tracer.threads, 0);
+  atomic_fetch_add(&tracer.generation, 1);
+  atomic_store(&tracer.active, true);
+
+  mtx_unlock(&tracer.lock);
+  return true;
+}
+
+void trace_end(void)
+{
+  if (!atomic_load(&tracer.active))
+    return;
+
+  atomic_store(&tracer.active, false);
+  trace_thread_flush();
+
+  mtx_lock(&tracer.lock);
+  fclose(tracer.file);
+  tracer.file = NULL;
+  mtx_unlock(&tracer.lock);
+}
+
+void trace_thread_flush(void)
+{
+  if (trace_buf.count > 0)
+    trace_write();
+}
+
+void trace_record(trace_op op, trace_kind kind, const void* owner, const void* ptr,
+  const void* old_ptr, size_t size, uintptr_t align)
+{
+  if (!atomic_load_explicit(&tracer.active, memory_order_relaxed) || trace_buf.suspended)
+    return;
+
+  size_t generation = atomic_load_explicit(&tracer.generation, memory_order_acquire);
+
+  // Records of an earlier trace are dropped.
+  if (trace_buf.generation != generation) {
+    trace_buf.generation = generation;
+    trace_buf.seq = 0;
+    trace_buf.count = 0;
+    trace_buf.thread = (uint16_t)atomic_fetch_add(&tracer.threads, 1);
+  }
+
+  trace_rec_t* rec = &trace_buf.recs[trace_buf.count++];
+  rec->time_ns = trace_now_ns() - tracer.start_ns;
+  rec->seq = trace_buf.seq++;
+  rec->owner = (uint64_t)(uintptr_t)owner;
+  rec->ptr = (uint64_t)(uintptr_t)ptr;
+  rec->old_ptr = (uint64_t)(uintptr_t)old_ptr;
+  rec->size = (uint64_t)size;
+  rec->align = (uint32_t)align;
+  rec->op = (uint8_t)op;
+  rec->kind = (uint8_t)kind;
+  rec->thread = trace_buf.thread;
+
+  if (trace_buf.count == TRACE_BUFFER_SIZE)
+    trace_write();
+}
+
+void trace_suspend(void)
+{
+  ++trace_buf.suspended;
+}
+
+void trace_resume(void)
+{
+  --trace_buf.suspended;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "base/config.h"
+
+/*
+  --- ALLOCATION TRACES ---
+
+  With `BASE_TRACE` defined, the allocators report every allocation,
+  resize and free to the tracer, which writes them to a binary file
+  between `trace_begin()` and `trace_end()`. Without it, the hooks compile
+  to nothing. Records are collected per thread and written in batches;
+  a thread other than the one calling `trace_end()` should call
+  `trace_thread_flush()` before, or its last records are lost.
+  `tools/trace_replay.c` runs a trace against any allocator of the library.
+
+  A trace file starts with a `trace_file_t`, followed by `trace_rec_t`
+  records. Blocks are identified by their addresses at recording time;
+  allocators by the address of their struct (`owner`). Freeing all blocks
+  of an allocator at once is a single `TRACE_FREE_ALL` record. Rolling an
+  arena back to a savepoint is a `TRACE_ROLLBACK`, which frees the blocks
+  of `owner` at or above `ptr`; that's exact unless the arena is chained.
+
+*/
+
+#define TRACE_MAGIC "BTRC"
+#define TRACE_VERSION 2
+
+// Records a thread collects before writing them to the file.
+#ifndef TRACE_BUFFER_SIZE
+  #define TRACE_BUFFER_SIZE 256
+#endif
+
+typedef enum {
+  TRACE_ALLOC,
+  TRACE_RESIZE,
+  TRACE_FREE,
+  TRACE_FREE_ALL,
+  TRACE_ROLLBACK,
+  TRACE_NUM_OPS
+} trace_op;
+
+typedef enum {
+  TRACE_ARENA,
+  TRACE_STACK,
+  TRACE_POOL,
+  TRACE_CPOOL,
+  TRACE_FREE_LIST,
+  TRACE_TLSF,
+  TRACE_GPA,
+  TRACE_NUM_KINDS
+} trace_kind;
+
+typedef struct trace_file {
+  char magic[4];
+  uint32_t version;
+} trace_file_t;
+
+typedef struct trace_rec {
+  int64_t time_ns;            // Since `trace_begin()`, from a monotonic clock.
+  uint64_t seq;               // Position among the records of its thread.
+  uint64_t owner;
+  uint64_t ptr;
+  uint64_t old_ptr;           // Block before a resize.
+  uint64_t size;
+  uint32_t align;
+  uint8_t op;
+  uint8_t kind;
+  uint16_t thread;            // Order in which threads first recorded.
+} trace_rec_t;
+
+#ifdef BASE_TRACE
+  #define TRACE(op, kind, owner, ptr, old_ptr, size, align)\
+    trace_record(op, kind, owner, ptr, old_ptr, size, align)
+  #define TRACE_SUSPEND() trace_suspend()
+  #define TRACE_RESUME() trace_resume()
+#else
+  #define TRACE(op, kind, owner, ptr, old_ptr, size, align) ((void)0)
+  #define TRACE_SUSPEND() ((void)0)
+  #define TRACE_RESUME() ((void)0)
+#endif
+
+/// @brief Starts recording into the file at `path`, which is overwritten.
+/// @return False if the file can't be opened or a trace is already running.
+bool trace_begin(const char* path);
+
+/// @brief Writes the records of the calling thread and closes the file.
+void trace_end(void);
+
+/// @brief Writes the records collected by the calling thread.
+void trace_thread_flush(void);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Adds a record to the calling thread's buffer, if a trace is running.
+void trace_record(trace_op op, trace_kind kind, const void* owner, const void* ptr,
+  const void* old_ptr, size_t size, uintptr_t align);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Stops recording on the calling thread until `trace_resume()`, for allocators
+/// built from other allocators, whose inner operations would be noise. Nests.
+void trace_suspend(void);
+
+/// @brief ---INTERNAL FUNCTION---
+/// Ends a `trace_suspend()`.
+void trace_resume(void);
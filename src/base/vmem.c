@@ -0,0 +1,305 @@
+#ifndef _WIN32
+  #define _DEFAULT_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "base/log.h"
+#include "base/vmem.h"
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#define VMEM_DEFAULT_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+// Nodes that `vmem_alloc_pages()` can bind to, and the `MPOL_BIND` policy of
+// `<linux/mempolicy.h>`, so that binding works without libnuma.
+#define VMEM_MAX_NODES 1024
+#define VMEM_MPOL_BIND 2
+
+#ifdef _WIN32
+
+size_t vmem_page_size(void)
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (size_t)info.dwPageSize;
+}
+
+void* vmem_reserve(size_t size)
+{
+  return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+bool vmem_commit(void* ptr, size_t size)
+{
+  return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void vmem_decommit(void* ptr, size_t size)
+{
+  VirtualFree(ptr, size, MEM_DECOMMIT);
+}
+
+void vmem_release(void* ptr, size_t size)
+{
+  VirtualFree(ptr, 0, MEM_RELEASE);
+}
+
+#else
+
+size_t vmem_page_size(void)
+{
+  static size_t page_size = 0;
+
+  if (!page_size)
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+  return page_size;
+}
+
+void* vmem_reserve(size_t size)
+{
+  void* ptr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+bool vmem_commit(void* ptr, size_t size)
+{
+  return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void vmem_decommit(void* ptr, size_t size)
+{
+  madvise(ptr, size, MADV_DONTNEED);
+  mprotect(ptr, size, PROT_NONE);
+}
+
+void vmem_release(void* ptr, size_t size)
+{
+  munmap(ptr, size);
+}
+
+#endif
+
+void* vmem_alloc_guarded(size_t size)
+{
+  size_t page_size = vmem_page_size();
+  size_t pages_size = (size + page_size - 1) & ~(page_size - 1);
+  unsigned char* base = (unsigned char*)vmem_reserve(pages_size + 2 * page_size);
+
+  if (!base)
+    return NULL;
+
+  if (!vmem_commit(base + page_size, pages_size)) {
+    vmem_release(base, pages_size + 2 * page_size);
+    return NULL;
+  }
+
+  return base + page_size + (pages_size - size);
+}
+
+void vmem_free_guarded(void* ptr, size_t size)
+{
+  size_t page_size = vmem_page_size();
+  size_t pages_size = (size + page_size - 1) & ~(page_size - 1);
+  uintptr_t first_page = (uintptr_t)ptr & ~(uintptr_t)(page_size - 1);
+
+  vmem_release((void*)(first_page - page_size), pages_size + 2 * page_size);
+}
+
+static size_t vmem_round_up(size_t size, size_t align)
+{
+  return (size + align - 1) & ~(align - 1);
+}
+
+/// Writes to every page, so that they are backed right away.
+static void vmem_prefault(void* ptr, size_t size, size_t page_size)
+{
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+
+  volatile unsigned char* bytes = (volatile unsigned char*)ptr;
+
+  for (size_t i = 0; i < size; i += page_size)
+    bytes[i] = 0;
+}
+
+#ifdef _WIN32
+
+size_t vmem_huge_page_size(void)
+{
+  size_t size = (size_t)GetLargePageMinimum();
+  return size ? size : VMEM_DEFAULT_HUGE_PAGE_SIZE;
+}
+
+static void* vmem_map(size_t size, DWORD type, int numa_node)
+{
+  if (numa_node == VMEM_ANY_NODE)
+    return VirtualAlloc(NULL, size, type, PAGE_READWRITE);
+
+  return VirtualAllocExNuma(GetCurrentProcess(), NULL, size, type, PAGE_READWRITE, (DWORD)numa_node);
+}
+
+vmem_pages_t vmem_alloc_pages(size_t size, unsigned flags, int numa_node)
+{
+  vmem_pages_t pages = { NULL, 0, false };
+  DWORD type = MEM_RESERVE | MEM_COMMIT;
+
+  // Needs the "Lock pages in memory" privilege. Large pages are never paged out,
+  // so they don't need to be prefaulted.
+  if (flags & VMEM_HUGE_PAGES) {
+    pages.size = vmem_round_up(size, vmem_huge_page_size());
+    pages.ptr = vmem_map(pages.size, type | MEM_LARGE_PAGES, numa_node);
+    pages.huge = pages.ptr != NULL;
+  }
+
+  if (!pages.ptr) {
+    pages.size = vmem_round_up(size, vmem_page_size());
+    pages.ptr = vmem_map(pages.size, type, numa_node);
+
+    if (pages.ptr && (flags & VMEM_POPULATE))
+      vmem_prefault(pages.ptr, pages.size, vmem_page_size());
+  }
+
+  if (!pages.ptr)
+    pages.size = 0;
+
+  return pages;
+}
+
+void vmem_free_pages(vmem_pages_t pages)
+{
+  if (pages.ptr)
+    VirtualFree(pages.ptr, 0, MEM_RELEASE);
+}
+
+#else
+
+size_t vmem_huge_page_size(void)
+{
+  static size_t huge_page_size = 0;
+
+  if (huge_page_size)
+    return huge_page_size;
+
+  size_t kib = 0;
+  FILE* file = fopen("/proc/meminfo", "r");
+
+  if (file) {
+    char line[128];
+
+    while (fgets(line, sizeof(line), file)) {
+      if (sscanf(line, "Hugepagesize: %zu kB", &kib) == 1)
+        break;
+    }
+
+    fclose(file);
+  }
+
+  huge_page_size = kib ? kib * 1024 : VMEM_DEFAULT_HUGE_PAGE_SIZE;
+  return huge_page_size;
+}
+
+static bool vmem_bind_node(void* ptr, size_t size, int numa_node)
+{
+#ifdef SYS_mbind
+  const int bits = (int)(8 * sizeof(unsigned long));
+  unsigned long mask[VMEM_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+  if (numa_node < 0 || numa_node >= VMEM_MAX_NODES)
+    return false;
+
+  mask[numa_node / bits] = 1ul << (numa_node % bits);
+
+  // The kernel reads one bit less than it's told to.
+  return syscall(SYS_mbind, ptr, size, VMEM_MPOL_BIND, mask, VMEM_MAX_NODES + 1, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+vmem_pages_t vmem_alloc_pages(size_t size, unsigned flags, int numa_node)
+{
+  vmem_pages_t pages = { NULL, 0, false };
+  bool bind = numa_node != VMEM_ANY_NODE;
+
+  // A binding or madvise() only affects the pages faulted in after it, so
+  // `MAP_POPULATE` is only used if there is neither.
+  bool prefault = (flags & VMEM_POPULATE) && (bind || (flags & VMEM_TRANSPARENT_HUGE));
+  int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if ((flags & VMEM_POPULATE) && !prefault)
+    map_flags |= MAP_POPULATE;
+
+#ifdef MAP_HUGETLB
+  // Fails if the system hasn't reserved enough huge pages.
+  if (flags & VMEM_HUGE_PAGES) {
+    size_t huge_size = vmem_round_up(size, vmem_huge_page_size());
+    void* ptr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, map_flags | MAP_HUGETLB, -1, 0);
+
+    if (ptr != MAP_FAILED) {
+      pages.ptr = ptr;
+      pages.size = huge_size;
+      pages.huge = true;
+    }
+  }
+#endif
+
+  if (!pages.ptr) {
+    size_t page_size = vmem_page_size();
+    size_t align = (flags & VMEM_TRANSPARENT_HUGE) ? vmem_huge_page_size() : page_size;
+    size_t pages_size = vmem_round_up(size, align);
+
+    // Maps more than needed so that the range can start at a huge page boundary,
+    // and unmaps the rest.
+    size_t map_size = pages_size + align - page_size;
+    unsigned char* base = (unsigned char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, map_flags, -1, 0);
+
+    if ((void*)base == MAP_FAILED)
+      return pages;
+
+    unsigned char* start = (unsigned char*)vmem_round_up((size_t)(uintptr_t)base, align);
+    size_t head = (size_t)(start - base);
+    size_t tail = map_size - head - pages_size;
+
+    if (head)
+      munmap(base, head);
+
+    if (tail)
+      munmap(start + pages_size, tail);
+
+#ifdef MADV_HUGEPAGE
+    if (flags & VMEM_TRANSPARENT_HUGE)
+      madvise(start, pages_size, MADV_HUGEPAGE);
+#endif
+
+    pages.ptr = start;
+    pages.size = pages_size;
+  }
+
+  if (bind && !vmem_bind_node(pages.ptr, pages.size, numa_node))
+    flog(LOG_WARNING, "vmem_alloc_pages(): can't bind memory to NUMA node %d", numa_node);
+
+  if (prefault)
+    vmem_prefault(pages.ptr, pages.size, pages.huge ? vmem_huge_page_size() : vmem_page_size());
+
+  return pages;
+}
+
+void vmem_free_pages(vmem_pages_t pages)
+{
+  if (pages.ptr)
+    munmap(pages.ptr, pages.size);
+}
+
+#endif
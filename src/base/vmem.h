@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+  --- VIRTUAL MEMORY ---
+
+  Thin wrapper around `mmap`/`VirtualAlloc`. Address space is reserved
+  first and only backed by physical memory once it is committed, so large
+  ranges can be set aside for growing allocators without paying for them
+  up front.
+
+*/
+
+/// @brief Returns the size of a virtual memory page. All sizes and addresses
+/// given to the other functions should be multiples of it.
+size_t vmem_page_size(void);
+
+/// @brief Reserves the given number of bytes of address space. The memory
+/// can't be accessed before it is committed.
+/// @return The start of the reserved range, or null on failure.
+void* vmem_reserve(size_t size);
+
+/// @brief Makes a reserved range readable and writable.
+/// @return False if the memory couldn't be committed.
+bool vmem_commit(void* ptr, size_t size);
+
+/// @brief Returns the physical memory behind a committed range to the OS.
+/// The range stays reserved and can be committed again.
+void vmem_decommit(void* ptr, size_t size);
+
+/// @brief Releases a range obtained from `vmem_reserve()`.
+void vmem_release(void* ptr, size_t size);
+
+/// @brief Maps `size` bytes of read-write memory between two inaccessible guard
+/// pages, so that running over either end faults right away. The range ends
+/// exactly at the second guard page; its start is aligned as well as `size` is,
+/// so round `size` up to the alignment the memory needs.
+/// @return The start of the range, or null on failure.
+void* vmem_alloc_guarded(size_t size);
+
+/// @brief Unmaps a range obtained from `vmem_alloc_guarded()`, along with its guard pages.
+void vmem_free_guarded(void* ptr, size_t size);
+
+/* 
+  --- PAGES ---
+
+  Committed memory straight from the OS for the allocators that take a
+  buffer, e.g. `pool_init(&pool, pages.ptr, pages.size, 64)`. Large pools
+  and arenas can be backed by huge pages to save TLB misses, bound to a NUMA
+  node to avoid remote accesses, and prefaulted so the first touch of each
+  page doesn't stall. All options are hints: if one isn't available, the
+  memory is handed out without it.
+
+*/
+
+typedef enum {
+  VMEM_HUGE_PAGES = 1 << 0,       // Explicit huge pages (`MAP_HUGETLB`, `MEM_LARGE_PAGES`).
+  VMEM_TRANSPARENT_HUGE = 1 << 1, // Aligns the range for transparent huge pages and asks for them.
+  VMEM_POPULATE = 1 << 2          // Faults all pages in up front.
+} vmem_page_flags;
+
+#define VMEM_ANY_NODE (-1)
+
+typedef struct vmem_pages {
+  void* ptr;
+  size_t size;                    // Rounded up to the (huge) page size.
+  bool huge;                      // Backed by explicit huge pages.
+} vmem_pages_t;
+
+/// @brief Returns the size of the default huge page, 2 MiB if it can't be determined.
+size_t vmem_huge_page_size(void);
+
+/// @brief Maps at least `size` bytes of zeroed, read-write memory. `flags` combines
+/// `vmem_page_flags`; `numa_node` binds the memory to a NUMA node, unless it's
+/// `VMEM_ANY_NODE`. Falls back to normal pages if no explicit huge pages are free.
+/// @return The mapped range, with a null `ptr` on failure.
+vmem_pages_t vmem_alloc_pages(size_t size, unsigned flags, int numa_node);
+
+/// @brief Unmaps a range obtained from `vmem_alloc_pages()`.
+void vmem_free_pages(vmem_pages_t pages);
@@ -0,0 +1,344 @@
+/*
+  --- LOG DECODER ---
+
+  Turns a binary log written by `flog()` in binary mode (see `log_init_binary()`)
+  into the same text format the synchronous logger produces. Messages of all
+  threads are sorted by their timestamps.
+
+  Usage: log_decode <file.blog> [output.txt]
+
+*/
+
+#ifdef _MSC_VER
+  #define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/allocators.h"
+#include "base/log.h"
+
+#define DECODE_MSG_SIZE 1024
+
+typedef struct decoded {
+  int64_t time_ns;
+  uint32_t thread_id;
+  size_t index;               // Position in the file.
+  char* line;
+} decoded_t;
+
+typedef struct fmt_entry {
+  uint64_t id;
+  char* format;
+} fmt_entry_t;
+
+/// Searches newest-first, so that a string written later wins over an older one with the same id.
+static const char* find_format(fmt_entry_t* formats, uint64_t id)
+{
+  for (size_t i = darray_size(formats); i-- > 0;) {
+    if (formats[i].id == id)
+      return formats[i].format;
+  }
+
+  return NULL;
+}
+
+static void clear_formats(fmt_entry_t* formats)
+{
+  for (size_t i = 0; i < darray_size(formats); ++i)
+    free(formats[i].format);
+
+  darray_clear(formats);
+}
+
+static bool read_u64(const unsigned char** p, const unsigned char* end, uint64_t* value)
+{
+  if ((size_t)(end - *p) < sizeof(*value))
+    return false;
+
+  memcpy(value, *p, sizeof(*value));
+  *p += sizeof(*value);
+  return true;
+}
+
+/// Appends one conversion to `out`, with `*` replaced by the recorded width/precision.
+static size_t decode_spec(char* out, size_t size, const log_spec_t* spec,
+  const unsigned char** p, const unsigned char* end)
+{
+  char fmt[64];
+  size_t n = 0;
+  uint64_t star = 0;
+
+  for (size_t i = 0; i < spec->len && n < sizeof(fmt) - 24; ++i) {
+    char c = spec->start[i];
+
+    if (c == '*') {
+      if (!read_u64(p, end, &star))
+        return (size_t)snprintf(out, size, "(?)");
+
+      n += (size_t)snprintf(fmt + n, sizeof(fmt) - n, "%d", (int)star);
+      continue;
+    }
+
+    fmt[n++] = c;
+  }
+
+  fmt[n] = '\0';
+
+  uint64_t v = 0;
+  double d = 0.0;
+  int len = 0;
+
+  if (spec->kind == LOG_ARG_NONE)
+    return spec->len == 2 && spec->start[1] == '%' ? (size_t)snprintf(out, size, "%%") : 0;
+
+  if (spec->kind == LOG_ARG_SKIP)
+    return 0;
+
+  if (spec->kind == LOG_ARG_STR) {
+    uint32_t str_len;
+
+    if ((size_t)(end - *p) < sizeof(str_len))
+      return (size_t)snprintf(out, size, "(?)");
+
+    memcpy(&str_len, *p, sizeof(str_len));
+    *p += sizeof(str_len);
+
+    if ((size_t)(end - *p) < str_len)
+      str_len = (uint32_t)(end - *p);
+
+    char str[DECODE_MSG_SIZE];
+    size_t copy = str_len < sizeof(str) - 1 ? str_len : sizeof(str) - 1;
+    memcpy(str, *p, copy);
+    str[copy] = '\0';
+    *p += str_len;
+
+    len = snprintf(out, size, fmt, str);
+    return len < 0 ? 0 : (size_t)len;
+  }
+
+  if (!read_u64(p, end, &v))
+    return (size_t)snprintf(out, size, "(?)");
+
+  memcpy(&d, &v, sizeof(d));
+
+  switch (spec->kind) {
+    case LOG_ARG_INT:     len = snprintf(out, size, fmt, (int)v); break;
+    case LOG_ARG_UINT:    len = snprintf(out, size, fmt, (unsigned int)v); break;
+    case LOG_ARG_LONG:    len = snprintf(out, size, fmt, (long)v); break;
+    case LOG_ARG_ULONG:   len = snprintf(out, size, fmt, (unsigned long)v); break;
+    case LOG_ARG_LLONG:   len = snprintf(out, size, fmt, (long long)v); break;
+    case LOG_ARG_ULLONG:  len = snprintf(out, size, fmt, (unsigned long long)v); break;
+    case LOG_ARG_SIZE:    len = snprintf(out, size, fmt, (size_t)v); break;
+    case LOG_ARG_INTMAX:  len = snprintf(out, size, fmt, (intmax_t)v); break;
+    case LOG_ARG_UINTMAX: len = snprintf(out, size, fmt, (uintmax_t)v); break;
+    case LOG_ARG_PTRDIFF: len = snprintf(out, size, fmt, (ptrdiff_t)v); break;
+    case LOG_ARG_PTR:     len = snprintf(out, size, fmt, (void*)(uintptr_t)v); break;
+    case LOG_ARG_DOUBLE:  len = snprintf(out, size, fmt, d); break;
+    case LOG_ARG_LDOUBLE: len = snprintf(out, size, fmt, (long double)d); break;
+    case LOG_ARG_NONE:
+    case LOG_ARG_STR:
+    case LOG_ARG_SKIP:
+    case LOG_ARG_NUM_KINDS:
+    default:
+      break;
+  }
+
+  return len < 0 ? 0 : (size_t)len;
+}
+
+static void decode_message(char* msg, size_t size, const char* format,
+  const unsigned char* payload, const unsigned char* end)
+{
+  log_spec_t spec;
+  const char* p = format;
+  size_t n = 0;
+
+  msg[0] = '\0';
+
+  for (;;) {
+    const char* literal = p;
+    bool found = log_next_spec(&p, &spec);
+    size_t literal_len = found ? (size_t)(spec.start - literal) : strlen(literal);
+
+    if (literal_len > size - 1 - n)
+      literal_len = size - 1 - n;
+
+    memcpy(msg + n, literal, literal_len);
+    n += literal_len;
+    msg[n] = '\0';
+
+    if (!found || n >= size - 1)
+      return;
+
+    n += decode_spec(msg + n, size - n, &spec, &payload, end);
+
+    if (n >= size - 1) {
+      msg[size - 1] = '\0';
+      return;
+    }
+  }
+}
+
+static int compare_decoded(const void* a, const void* b)
+{
+  const decoded_t* da = (const decoded_t*)a;
+  const decoded_t* db = (const decoded_t*)b;
+
+  if (da->time_ns != db->time_ns)
+    return da->time_ns < db->time_ns ? -1 : 1;
+
+  if (da->thread_id != db->thread_id)
+    return da->thread_id < db->thread_id ? -1 : 1;
+
+  return da->index < db->index ? -1 : da->index > db->index;
+}
+
+static unsigned char* read_file(const char* path, size_t* size)
+{
+  FILE* file = fopen(path, "rb");
+
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  unsigned char* data = file_size > 0 ? (unsigned char*)malloc((size_t)file_size) : NULL;
+
+  if (data && fread(data, 1, (size_t)file_size, file) != (size_t)file_size) {
+    free(data);
+    data = NULL;
+  }
+
+  fclose(file);
+  *size = data ? (size_t)file_size : 0;
+  return data;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file.blog> [output.txt]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  size_t size = 0;
+  unsigned char* data = read_file(argv[1], &size);
+  log_bin_file_t file_hdr;
+
+  if (!data || size < sizeof(file_hdr)) {
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  memcpy(&file_hdr, data, sizeof(file_hdr));
+
+  if (memcmp(file_hdr.magic, LOG_BIN_MAGIC, sizeof(file_hdr.magic)) != 0 ||
+      file_hdr.version < 1 || file_hdr.version > LOG_BIN_VERSION ||
+      file_hdr.long_size != sizeof(long) || file_hdr.ptr_size != sizeof(void*)) {
+    fprintf(stderr, "%s: %s is no binary log of this platform\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  FILE* out = argc > 2 ? fopen(argv[2], "w") : stdout;
+
+  if (!out) {
+    fprintf(stderr, "%s: can't open %s\n", argv[0], argv[2]);
+    return EXIT_FAILURE;
+  }
+
+  fmt_entry_t* formats = darray_init(sizeof(fmt_entry_t), 64);
+  decoded_t* lines = darray_init(sizeof(decoded_t), 1024);
+  const unsigned char* p = data + sizeof(file_hdr);
+  const unsigned char* end = data + size;
+  uint32_t thread_id = 0;
+
+  while ((size_t)(end - p) >= sizeof(log_bin_hdr_t)) {
+    log_bin_hdr_t hdr;
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+
+    if ((size_t)(end - p) < hdr.size) {
+      fprintf(stderr, "%s: truncated record at the end of %s\n", argv[0], argv[1]);
+      break;
+    }
+
+    const unsigned char* payload = p;
+    p += hdr.size;
+
+    char msg[DECODE_MSG_SIZE];
+    char line[DECODE_MSG_SIZE + 64];
+    char time_buf[32];
+    log_type type = LOG_WARNING;
+
+    switch (hdr.tag) {
+      case 'S': {
+        fmt_entry_t entry = { hdr.id, (char*)malloc(hdr.size + 1) };
+        memcpy(entry.format, payload, hdr.size);
+        entry.format[hdr.size] = '\0';
+        darray_push(formats, entry);
+        continue;
+      }
+
+      case 'T':
+        thread_id = (uint32_t)hdr.id;
+        continue;
+
+      case 'N':
+        clear_formats(formats);
+        thread_id = 0;
+        continue;
+
+      case 'D':
+        snprintf(msg, sizeof(msg), "log buffer of thread %u full, %llu message(s) dropped",
+          thread_id, (unsigned long long)hdr.id);
+        break;
+
+      case 'M': {
+        const char* format = find_format(formats, hdr.id);
+        type = hdr.type < LOG_NUM_TYPES ? (log_type)hdr.type : LOG_NUM_TYPES;
+
+        if (format)
+          decode_message(msg, sizeof(msg), format, payload, payload + hdr.size);
+        else
+          snprintf(msg, sizeof(msg), "(unknown format string %llx)", (unsigned long long)hdr.id);
+
+        break;
+      }
+
+      default:
+        fprintf(stderr, "%s: unknown record '%c', stopping\n", argv[0], hdr.tag);
+        p = end;
+        continue;
+    }
+
+    log_format_time((time_t)(hdr.time_ns / 1000000000), time_buf, sizeof(time_buf));
+    log_format_line(line, sizeof(line), type, time_buf, msg);
+
+    decoded_t entry = { hdr.time_ns, thread_id, darray_size(lines), (char*)malloc(strlen(line) + 1) };
+    strcpy(entry.line, line);
+    darray_push(lines, entry);
+  }
+
+  qsort(lines, darray_size(lines), sizeof(decoded_t), compare_decoded);
+
+  for (size_t i = 0; i < darray_size(lines); ++i) {
+    fputs(lines[i].line, out);
+    free(lines[i].line);
+  }
+
+  clear_formats(formats);
+
+  if (out != stdout)
+    fclose(out);
+
+  darray_free(lines);
+  darray_free(formats);
+  free(data);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,605 @@
+/*
+  --- TRACE REPLAY ---
+
+  Runs an allocation trace, recorded with `BASE_TRACE` (see `trace.h`),
+  against the allocators of the library and reports for each of them:
+    time_ms, ns_per_op - time spent in the allocator.
+    peak_live          - peak of the bytes the trace holds; the same for all.
+    peak_used          - peak of the bytes the allocator has in use, including
+                         headers, padding and rounding (null for malloc).
+    overhead           - peak_used / peak_live - 1.
+    fragmentation      - highest external fragmentation seen in the free
+                         blocks, sampled every `REPLAY_SAMPLE` operations
+                         (null where free blocks aren't tracked).
+    failed             - allocations and resizes that didn't succeed.
+  One JSON object per allocator and line. Records of all threads are
+  merged by their timestamps and replayed on a single thread.
+  The pool gets slots as large as the largest allocation in the trace.
+
+  Usage: trace_replay <file.trace> [allocator] [kind]
+  `allocator` is one of malloc, gpa, arena, pool, free_list_first,
+  free_list_best, tlsf, or all (the default). `kind` limits the replay to
+  the records of one kind of allocator, e.g. free_list.
+
+*/
+
+#ifdef _MSC_VER
+  #define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base/allocators.h"
+#include "base/gpa.h"
+#include "base/hashmap.h"
+#include "base/trace.h"
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#endif
+
+#define REPLAY_SAMPLE 1024
+#define REPLAY_ARENA_RESERVE ((size_t)64 * 1024 * 1024 * 1024)
+
+typedef struct replay_op {
+  uint8_t op;
+  uint32_t id;
+  uint32_t align;
+  size_t size;
+} replay_op_t;
+
+typedef struct replay_block {
+  uint64_t owner;
+  uint64_t ptr;
+  size_t size;
+  size_t live_index;          // Position in the list of live blocks.
+} replay_block_t;
+
+typedef struct replay_trace {
+  replay_op_t* ops;
+  size_t num_blocks;
+  size_t peak_live;
+  size_t peak_count;
+  size_t max_size;
+  uint32_t max_align;
+  size_t unmatched;
+} replay_trace_t;
+
+typedef struct replay_target replay_target_t;
+
+struct replay_target {
+  const char* name;
+  allocator_t allocator;
+  unsigned char* buf;
+  size_t buf_size;
+  union {
+    arena_t arena;
+    pool_t pool;
+    free_list_t fl;
+    tlsf_t tlsf;
+  } impl;
+  bool (*stats)(replay_target_t* target, alloc_stats_t* stats);
+};
+
+static const char* kind_names[TRACE_NUM_KINDS] = {
+  "arena", "stack", "pool", "cpool", "free_list", "tlsf", "gpa"
+};
+
+static const char* target_names[] = {
+  "malloc", "gpa", "arena", "pool", "free_list_first", "free_list_best", "tlsf"
+};
+
+/// A monotonic clock, so that a step of the wall clock can't distort the replay time.
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+
+  if (!frequency.QuadPart)
+    QueryPerformanceFrequency(&frequency);
+
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static unsigned char* read_file(const char* path, size_t* size)
+{
+  FILE* file = fopen(path, "rb");
+
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  unsigned char* data = file_size > 0 ? (unsigned char*)malloc((size_t)file_size) : NULL;
+
+  if (data && fread(data, 1, (size_t)file_size, file) != (size_t)file_size) {
+    free(data);
+    data = NULL;
+  }
+
+  fclose(file);
+  *size = data ? (size_t)file_size : 0;
+  return data;
+}
+
+static int compare_recs(const void* a, const void* b)
+{
+  const trace_rec_t* ra = (const trace_rec_t*)a;
+  const trace_rec_t* rb = (const trace_rec_t*)b;
+
+  if (ra->time_ns != rb->time_ns)
+    return ra->time_ns < rb->time_ns ? -1 : 1;
+
+  if (ra->thread != rb->thread)
+    return ra->thread < rb->thread ? -1 : 1;
+
+  // Records of a thread keep the order they were made in.
+  return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+/*
+  --- PREPROCESSING ---
+
+  Turns the records into operations on dense block ids, so the replay
+  itself does no lookups. Frees of whole allocators become single frees.
+*/
+
+typedef struct replay_builder {
+  replay_trace_t* trace;
+  hashmap_t* ids;             // Recorded address -> block id.
+  replay_block_t* blocks;
+  uint32_t* live;
+  size_t live_bytes;
+} replay_builder_t;
+
+static void builder_emit(replay_builder_t* b, uint8_t op, uint32_t id, size_t size, uint32_t align)
+{
+  replay_op_t rop = { op, id, align, size };
+  darray_push(b->trace->ops, rop);
+}
+
+static void builder_free(replay_builder_t* b, uint32_t id)
+{
+  replay_block_t* block = &b->blocks[id];
+  size_t index = block->live_index;
+  uint32_t last = b->live[darray_size(b->live) - 1];
+
+  b->live[index] = last;
+  b->blocks[last].live_index = index;
+  darray_pop_last(b->live);
+
+  hashmap_remove(b->ids, &block->ptr);
+  b->live_bytes -= block->size;
+  builder_emit(b, TRACE_FREE, id, block->size, 0);
+}
+
+static void builder_alloc(replay_builder_t* b, const trace_rec_t* rec)
+{
+  bool found = false;
+  uint32_t* slot = (uint32_t*)hashmap_insert(&b->ids, &rec->ptr, &found);
+
+  // A block at the same address that was never freed, e.g. by an untraced clear.
+  if (found) {
+    uint32_t old = *slot;
+    builder_free(b, old);
+    slot = (uint32_t*)hashmap_insert(&b->ids, &rec->ptr, NULL);
+  }
+
+  uint32_t id = (uint32_t)darray_size(b->blocks);
+  replay_block_t block = { rec->owner, rec->ptr, (size_t)rec->size, darray_size(b->live) };
+  darray_push(b->blocks, block);
+  darray_push(b->live, id);
+  *slot = id;
+
+  b->live_bytes += block.size;
+  builder_emit(b, TRACE_ALLOC, id, block.size, rec->align);
+
+  replay_trace_t* t = b->trace;
+  t->peak_live = b->live_bytes > t->peak_live ? b->live_bytes : t->peak_live;
+  t->peak_count = darray_size(b->live) > t->peak_count ? darray_size(b->live) : t->peak_count;
+  t->max_size = block.size > t->max_size ? block.size : t->max_size;
+  t->max_align = rec->align > t->max_align ? rec->align : t->max_align;
+}
+
+static void builder_resize(replay_builder_t* b, const trace_rec_t* rec)
+{
+  uint32_t* slot = (uint32_t*)hashmap_get(b->ids, &rec->old_ptr);
+
+  if (!slot) {
+    builder_alloc(b, rec);
+    return;
+  }
+
+  uint32_t id = *slot;
+  replay_block_t* block = &b->blocks[id];
+
+  if (rec->ptr != rec->old_ptr) {
+    hashmap_remove(b->ids, &rec->old_ptr);
+    *(uint32_t*)hashmap_insert(&b->ids, &rec->ptr, NULL) = id;
+    block->ptr = rec->ptr;
+  }
+
+  b->live_bytes = b->live_bytes - block->size + (size_t)rec->size;
+  block->size = (size_t)rec->size;
+  builder_emit(b, TRACE_RESIZE, id, block->size, rec->align);
+
+  replay_trace_t* t = b->trace;
+  t->peak_live = b->live_bytes > t->peak_live ? b->live_bytes : t->peak_live;
+  t->max_size = block->size > t->max_size ? block->size : t->max_size;
+}
+
+/// Frees the live blocks of `owner` at or above `mark`.
+static void builder_free_owner(replay_builder_t* b, uint64_t owner, uint64_t mark)
+{
+  for (size_t i = darray_size(b->live); i-- > 0;) {
+    replay_block_t* block = &b->blocks[b->live[i]];
+
+    if (block->owner == owner && block->ptr >= mark)
+      builder_free(b, b->live[i]);
+  }
+}
+
+static bool build_trace(replay_trace_t* trace, trace_rec_t* recs, size_t count, int kind)
+{
+  replay_builder_t b = { trace, hashmap_init(sizeof(uint64_t), sizeof(uint32_t), 1024), NULL, NULL, 0 };
+  b.blocks = darray_init(sizeof(replay_block_t), 1024);
+  b.live = darray_init(sizeof(uint32_t), 1024);
+  trace->ops = darray_init(sizeof(replay_op_t), count);
+
+  qsort(recs, count, sizeof(trace_rec_t), compare_recs);
+
+  for (size_t i = 0; i < count; ++i) {
+    const trace_rec_t* rec = &recs[i];
+
+    if (kind >= 0 && rec->kind != kind)
+      continue;
+
+    switch (rec->op) {
+      case TRACE_ALLOC:
+        builder_alloc(&b, rec);
+        break;
+
+      case TRACE_RESIZE:
+        builder_resize(&b, rec);
+        break;
+
+      case TRACE_FREE: {
+        uint32_t* slot = (uint32_t*)hashmap_get(b.ids, &rec->ptr);
+
+        if (slot)
+          builder_free(&b, *slot);
+        else
+          ++trace->unmatched;
+
+        break;
+      }
+
+      case TRACE_FREE_ALL:
+        builder_free_owner(&b, rec->owner, 0);
+        break;
+
+      case TRACE_ROLLBACK:
+        builder_free_owner(&b, rec->owner, rec->ptr);
+        break;
+
+      default:
+        fprintf(stderr, "trace_replay: unknown operation %u, stopping\n", rec->op);
+        i = count;
+        break;
+    }
+  }
+
+  trace->num_blocks = darray_size(b.blocks);
+
+  hashmap_free(b.ids);
+  darray_free(b.blocks);
+  darray_free(b.live);
+
+  return true;
+}
+
+/*
+  --- TARGETS ---
+*/
+
+static bool arena_target_stats(replay_target_t* target, alloc_stats_t* stats)
+{
+  *stats = arena_stats(&target->impl.arena);
+  return true;
+}
+
+static bool pool_target_stats(replay_target_t* target, alloc_stats_t* stats)
+{
+  *stats = pool_stats(&target->impl.pool);
+  return true;
+}
+
+static bool free_list_target_stats(replay_target_t* target, alloc_stats_t* stats)
+{
+  *stats = free_list_stats(&target->impl.fl);
+  return true;
+}
+
+static bool tlsf_target_stats(replay_target_t* target, alloc_stats_t* stats)
+{
+  *stats = tlsf_stats(&target->impl.tlsf);
+  return true;
+}
+
+static bool gpa_target_stats(replay_target_t* target, alloc_stats_t* stats)
+{
+  gpa_stats_t gpa = gpa_stats();
+  *stats = (alloc_stats_t){ 0 };
+  stats->in_use = gpa.small_in_use + gpa.large_reserved;
+  stats->peak = stats->in_use;
+  return true;
+}
+
+static bool target_init(replay_target_t* target, const char* name, const replay_trace_t* trace)
+{
+  *target = (replay_target_t){ 0 };
+  target->name = name;
+
+  // Room for the peak, twice over for fragmentation, plus a header per block.
+  target->buf_size = 2 * trace->peak_live + 64 * trace->peak_count + ((size_t)1 << 20);
+
+  if (strcmp(name, "malloc") == 0) {
+    target->allocator = heap_allocator();
+    return true;
+  }
+
+  if (strcmp(name, "gpa") == 0) {
+    target->allocator = gpa_allocator();
+    target->stats = gpa_target_stats;
+    return true;
+  }
+
+  if (strcmp(name, "arena") == 0) {
+    arena_init_virtual(&target->impl.arena, REPLAY_ARENA_RESERVE, SIZE_MAX);
+    target->allocator = arena_allocator(&target->impl.arena);
+    target->stats = arena_target_stats;
+    return true;
+  }
+
+  target->buf = (unsigned char*)malloc(target->buf_size);
+
+  if (!target->buf) {
+    fprintf(stderr, "trace_replay: can't allocate %zu bytes for %s\n", target->buf_size, name);
+    return false;
+  }
+
+  if (strcmp(name, "pool") == 0) {
+    uintptr_t align = trace->max_align > DEFAULT_ALIGN ? trace->max_align : DEFAULT_ALIGN;
+    size_t slots = trace->peak_count + 1;
+    size_t slot_size = (size_t)align_size(trace->max_size ? trace->max_size : 1, align);
+
+    free(target->buf);
+    target->buf_size = slots * slot_size + align;
+    target->buf = (unsigned char*)malloc(target->buf_size);
+
+    if (!target->buf) {
+      fprintf(stderr, "trace_replay: can't allocate %zu bytes for the pool\n", target->buf_size);
+      return false;
+    }
+
+    pool_init_align(&target->impl.pool, target->buf, target->buf_size, slot_size, align);
+    target->allocator = pool_allocator(&target->impl.pool);
+    target->stats = pool_target_stats;
+  } else if (strcmp(name, "free_list_first") == 0 || strcmp(name, "free_list_best") == 0) {
+    free_list_init(&target->impl.fl, target->buf, target->buf_size);
+    target->allocator = free_list_allocator(&target->impl.fl, name[10] == 'f' ? FIRST_SLOT : BEST_SLOT);
+    target->stats = free_list_target_stats;
+  } else if (strcmp(name, "tlsf") == 0) {
+    tlsf_init(&target->impl.tlsf, target->buf, target->buf_size);
+    target->allocator = tlsf_allocator(&target->impl.tlsf);
+    target->stats = tlsf_target_stats;
+  } else {
+    fprintf(stderr, "trace_replay: unknown allocator %s\n", name);
+    free(target->buf);
+    return false;
+  }
+
+  return true;
+}
+
+static void target_release(replay_target_t* target)
+{
+  if (strcmp(target->name, "arena") == 0)
+    arena_release(&target->impl.arena);
+
+  if (strcmp(target->name, "gpa") == 0)
+    gpa_thread_flush();
+
+  free(target->buf);
+}
+
+static void replay(const char* path, const char* name, const replay_trace_t* trace)
+{
+  replay_target_t target;
+
+  if (!target_init(&target, name, trace))
+    return;
+
+  void** ptrs = (void**)calloc(trace->num_blocks + 1, sizeof(void*));
+  size_t* sizes = (size_t*)calloc(trace->num_blocks + 1, sizeof(size_t));
+  size_t count = darray_size(trace->ops);
+  size_t failed = 0;
+  size_t peak_used = 0;
+  double fragmentation = 0.0;
+  uint64_t elapsed = 0;
+
+  if (!ptrs || !sizes) {
+    fprintf(stderr, "trace_replay: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t first = 0; first < count; first += REPLAY_SAMPLE) {
+    size_t last = first + REPLAY_SAMPLE < count ? first + REPLAY_SAMPLE : count;
+    uint64_t start = now_ns();
+
+    for (size_t i = first; i < last; ++i) {
+      const replay_op_t* op = &trace->ops[i];
+      uintptr_t align = op->align ? op->align : DEFAULT_ALIGN;
+
+      switch (op->op) {
+        case TRACE_ALLOC:
+          ptrs[op->id] = allocator_alloc(&target.allocator, op->size, align);
+          sizes[op->id] = op->size;
+          failed += !ptrs[op->id];
+          break;
+
+        case TRACE_RESIZE: {
+          void* resized = allocator_resize(&target.allocator, ptrs[op->id], sizes[op->id], op->size, align);
+
+          if (resized) {
+            ptrs[op->id] = resized;
+            sizes[op->id] = op->size;
+          } else {
+            ++failed;
+          }
+
+          break;
+        }
+
+        case TRACE_FREE:
+          if (ptrs[op->id])
+            allocator_free(&target.allocator, ptrs[op->id], sizes[op->id]);
+
+          ptrs[op->id] = NULL;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    elapsed += now_ns() - start;
+
+    alloc_stats_t stats;
+
+    if (target.stats && target.stats(&target, &stats)) {
+      peak_used = stats.peak > peak_used ? stats.peak : peak_used;
+      fragmentation = stats.fragmentation > fragmentation ? stats.fragmentation : fragmentation;
+    }
+  }
+
+  // Blocks the trace never freed.
+  for (size_t i = 0; i < trace->num_blocks; ++i) {
+    if (ptrs[i])
+      allocator_free(&target.allocator, ptrs[i], sizes[i]);
+  }
+
+  char used[32] = "null";
+  char overhead[32] = "null";
+  char frag[32] = "null";
+
+  if (target.stats) {
+    snprintf(used, sizeof(used), "%zu", peak_used);
+
+    if (trace->peak_live > 0)
+      snprintf(overhead, sizeof(overhead), "%.4f", (double)peak_used / (double)trace->peak_live - 1.0);
+  }
+
+  if (target.stats == free_list_target_stats || target.stats == tlsf_target_stats)
+    snprintf(frag, sizeof(frag), "%.4f", fragmentation);
+
+  printf("{\"trace\": \"%s\", \"allocator\": \"%s\", \"ops\": %zu, \"time_ms\": %.3f, \"ns_per_op\": %.2f, "
+    "\"peak_live\": %zu, \"peak_used\": %s, \"overhead\": %s, \"fragmentation\": %s, \"failed\": %zu}\n",
+    path, name, count, (double)elapsed / 1e6, count ? (double)elapsed / (double)count : 0.0,
+    trace->peak_live, used, overhead, frag, failed);
+
+  free(ptrs);
+  free(sizes);
+  target_release(&target);
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file.trace> [allocator] [kind]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char* target = argc > 2 ? argv[2] : "all";
+  bool known = strcmp(target, "all") == 0;
+  int kind = -1;
+
+  for (size_t i = 0; i < sizeof(target_names) / sizeof(target_names[0]); ++i)
+    known |= strcmp(target, target_names[i]) == 0;
+
+  if (!known) {
+    fprintf(stderr, "%s: unknown allocator %s\n", argv[0], target);
+    fprintf(stderr, "usage: %s <file.trace> [allocator] [kind]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (argc > 3) {
+    for (int k = 0; k < TRACE_NUM_KINDS; ++k) {
+      if (strcmp(argv[3], kind_names[k]) == 0)
+        kind = k;
+    }
+
+    if (kind < 0) {
+      fprintf(stderr, "%s: unknown kind %s\n", argv[0], argv[3]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  size_t size = 0;
+  unsigned char* data = read_file(argv[1], &size);
+  trace_file_t file_hdr;
+
+  if (!data || size < sizeof(file_hdr)) {
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  memcpy(&file_hdr, data, sizeof(file_hdr));
+
+  if (memcmp(file_hdr.magic, TRACE_MAGIC, sizeof(file_hdr.magic)) != 0 || file_hdr.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: %s is no allocation trace\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  size_t count = (size - sizeof(file_hdr)) / sizeof(trace_rec_t);
+  trace_rec_t* recs = (trace_rec_t*)malloc(count * sizeof(trace_rec_t) + 1);
+
+  if (!recs) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  memcpy(recs, data + sizeof(file_hdr), count * sizeof(trace_rec_t));
+  free(data);
+
+  replay_trace_t trace = { 0 };
+  build_trace(&trace, recs, count, kind);
+  free(recs);
+
+  if (trace.unmatched > 0)
+    fprintf(stderr, "%s: %zu frees of unknown blocks ignored\n", argv[0], trace.unmatched);
+
+  for (size_t i = 0; i < sizeof(target_names) / sizeof(target_names[0]); ++i) {
+    if (strcmp(target, "all") == 0 || strcmp(target, target_names[i]) == 0)
+      replay(argv[1], target_names[i], &trace);
+  }
+
+  darray_free(trace.ops);
+
+  return 0;
+}